@@ -26,7 +26,10 @@
 #include "tx.h"
 #include "schedule.h"
 
+#include <errno.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef __APPLE__
 # define SIGSTATS SIGINFO
@@ -42,6 +45,24 @@
 #define POLL_NEW_UNICAST 0x1
 #define POLL_NEW_MULTICAST 0x2
 
+#define TX_QUEUE_UNICAST_LEN 32 /* per peer */
+#define TX_QUEUE_MULTICAST_LEN 16
+#define TX_QUEUE_HOLD_LEN 16
+#define TX_HOLD_TIMEOUT 500000 /* in us */
+
+#define AMSDU_MAX_SUBFRAMES 32
+
+struct tx_held {
+	struct buf *buf;
+	uint64_t since;
+};
+
+#define CHAN_SWITCH_LEAD_DEFAULT 500 /* in us */
+
+
+#define RX_BATCH_FRAMES_DEFAULT 64
+#define RX_BATCH_USEC_DEFAULT 2000
+
 static void dump_frame(const char *dump_file, const struct pcap_pkthdr *hdr, const uint8_t *buf) {
 	if (dump_file) {
 		/* Make sure file exists because 'pcap_dump_open_append' does NOT create file for you */
@@ -54,257 +75,642 @@ static void dump_frame(const char *dump_file, const struct pcap_pkthdr *hdr, con
 	}
 }
 
-static void ev_timer_rearm(struct ev_loop *loop, ev_timer *timer, double in) {
-	ev_timer_stop(loop, timer);
-	ev_timer_set(timer, in, 0.);
-	ev_timer_start(loop, timer);
+/* Time (in us) until the first of the timing-critical events (channel switch, PSF, MIF) is due */
+static uint64_t awdl_critical_event_in(struct daemon_state *state, uint64_t now) {
+	uint64_t next = slot_engine_next(&state->ev_state.slots, SLOT_EVENT_MASK(SLOT_EVENT_CHAN) |
+	                                                        SLOT_EVENT_MASK(SLOT_EVENT_PSF) |
+	                                                        SLOT_EVENT_MASK(SLOT_EVENT_MIF));
+	if (next == UINT64_MAX)
+		return UINT64_MAX;
+	return next > now ? next - now : 0;
+}
+
+/* Receive frames until the device is drained or the budget is exhausted.
+ * Returns true if there may be more frames pending. */
+static bool wlan_drain(struct ev_loop *loop, struct daemon_state *state) {
+	(void) loop;
+	uint64_t start = clock_time_us();
+	uint64_t budget_usec = state->rx_batch_usec;
+	uint64_t event_in = awdl_critical_event_in(state, start);
+	int budget_frames = state->rx_batch_frames;
+
+	if (event_in < budget_usec)
+		budget_usec = event_in; /* yield before the next channel switch or action frame is due */
+
+	while (budget_frames > 0) {
+		int cnt = wlan_recv(&state->io, budget_frames, &awdl_receive_frame, (uint8_t *) state);
+		if (cnt <= 0)
+			return false; /* drained (or error) */
+		budget_frames -= cnt;
+		if (clock_time_us() - start >= budget_usec)
+			break;
+	}
+	return true;
 }
 
 void wlan_device_ready(struct ev_loop *loop, ev_io *handle, int revents) {
+	(void) revents; /* should always be EV_READ */
 	struct daemon_state *state = handle->data;
-	int cnt = pcap_dispatch(state->io.wlan_handle, 1, &awdl_receive_frame, handle->data);
-	if (cnt > 0)
-		ev_feed_event(loop, handle, revents);
+	/* Frames might remain in the capture buffer without the fd being readable again, so continue
+	 * draining from an idle watcher which lets the loop run due timers first */
+	if (wlan_drain(loop, state))
+		ev_idle_start(loop, &state->ev_state.read_wlan_idle);
 }
 
-static int poll_host_device(struct daemon_state *state) {
-	struct buf *buf = NULL;
+void wlan_device_idle(struct ev_loop *loop, ev_idle *handle, int revents) {
+	(void) revents;
+	struct daemon_state *state = handle->data;
+	if (!wlan_drain(loop, state))
+		ev_idle_stop(loop, handle);
+}
+
+static cbuf_handle_t peer_tx_queue(struct awdl_peer *peer) {
+	if (!peer->tx_queue)
+		peer->tx_queue = circular_buf_init(TX_QUEUE_UNICAST_LEN);
+	return peer->tx_queue;
+}
+
+static void tx_held_drop(struct daemon_state *state, struct tx_held *held) {
+	struct ether_addr dst;
+	read_ether_addr(held->buf, ETHER_DST_OFFSET, &dst);
+	log_debug("Drop frame to non-peer %s", ether_ntoa(&dst));
+	buf_free(held->buf);
+	free(held);
+	state->awdl_state.stats.tx_data_dropped++;
+}
+
+/* Queue frame read from host, returns POLL_NEW_* or -1 if the queue is full */
+static int tx_enqueue(struct daemon_state *state, struct buf *buf, uint64_t now) {
+	struct awdl_state *awdl_state = &state->awdl_state;
+	struct awdl_peer *peer;
+	struct ether_addr dst;
+	struct tx_held *held;
+
+	READ_ETHER_ADDR(buf, ETHER_DST_OFFSET, &dst);
+
+	if (dst.ether_addr_octet[0] & 0x01) { /* multicast */
+		if (circular_buf_put2(state->tx_queue_multicast, buf) < 0)
+			return -1;
+		return POLL_NEW_MULTICAST;
+	}
+
+	if (compare_ether_addr(&dst, &awdl_state->self_address) == 0) {
+		/* send back to self */
+		host_send(&state->io, buf_data(buf), buf_len(buf));
+		buf_free(buf);
+		return 0;
+	}
+
+	if (awdl_peer_get(awdl_state->peers.peers, &dst, &peer) == PEERS_OK && peer->is_valid) {
+		if (circular_buf_put2(peer_tx_queue(peer), buf) < 0)
+			return -1;
+		return POLL_NEW_UNICAST;
+	}
+
+	/* hold for a while, peer might still be discovered or turn valid */
+	held = malloc(sizeof(struct tx_held));
+	if (!held)
+		goto wire_error; /* drop */
+	if (circular_buf_full(state->tx_queue_hold)) {
+		void *oldest;
+		circular_buf_get(state->tx_queue_hold, &oldest, 0);
+		tx_held_drop(state, oldest);
+	}
+	held->buf = buf;
+	held->since = now;
+	circular_buf_put2(state->tx_queue_hold, held);
+	return POLL_NEW_UNICAST;
+
+wire_error:
+	buf_free(buf);
+	awdl_state->stats.tx_data_dropped++;
+	return 0;
+}
+
+/* Move held frames to peers that have turned valid in the meantime and drop expired ones */
+static void tx_release_held(struct daemon_state *state, uint64_t now) {
+	size_t num_held = circular_buf_size(state->tx_queue_hold);
+
+	while (num_held--) {
+		void *next;
+		struct tx_held *held;
+		struct awdl_peer *peer;
+		struct ether_addr dst;
+
+		circular_buf_get(state->tx_queue_hold, &next, 0);
+		held = next;
+		read_ether_addr(held->buf, ETHER_DST_OFFSET, &dst);
+		if (awdl_peer_get(state->awdl_state.peers.peers, &dst, &peer) == PEERS_OK && peer->is_valid &&
+		    circular_buf_put2(peer_tx_queue(peer), held->buf) == 0) {
+			free(held);
+		} else if (now - held->since > TX_HOLD_TIMEOUT) {
+			tx_held_drop(state, held);
+		} else {
+			circular_buf_put2(state->tx_queue_hold, held); /* keep order */
+		}
+	}
+}
+
+static int poll_host_device(struct ev_loop *loop, struct daemon_state *state) {
+	struct buf *buf;
 	int result = 0;
-	while (!state->next && !circular_buf_full(state->tx_queue_multicast)) {
-		buf = buf_new_owned(ETHER_MAX_LEN);
-		int len = buf_len(buf);
+	uint64_t now = clock_time_us();
+
+	while (!state->tx_blocked) {
+		int len, queued;
+		buf = buf_new_owned_reserve(AWDL_DATA_HEADROOM, ETHER_MAX_LEN, AWDL_DATA_TAILROOM);
+		len = buf_len(buf);
 		if (host_recv(&state->io, (uint8_t *) buf_data(buf), &len) < 0) {
-			goto wire_error;
-		} else {
-			bool is_multicast;
-			struct ether_addr dst;
-			buf_take(buf, buf_len(buf) - len);
-			READ_ETHER_ADDR(buf, ETHER_DST_OFFSET, &dst);
-			is_multicast = dst.ether_addr_octet[0] & 0x01;
-			if (is_multicast) {
-				circular_buf_put(state->tx_queue_multicast, buf);
-				result |= POLL_NEW_MULTICAST;
-			} else { /* unicast */
-				state->next = buf;
-				result |= POLL_NEW_UNICAST;
-			}
+			buf_free(buf);
+			break;
+		}
+		buf_take(buf, buf_len(buf) - len);
+		queued = tx_enqueue(state, buf, now);
+		if (queued < 0) { /* stop reading from host until there is space again */
+			state->tx_blocked = buf;
+			ev_io_stop(loop, &state->ev_state.read_host);
+			break;
 		}
+		result |= queued;
 	}
 	return result;
-wire_error:
-	if (buf)
-		buf_free(buf);
-	return result;
+}
+
+/* Resume reading from host once the frame that did not fit could be queued, returns POLL_NEW_* */
+static int tx_unblock(struct ev_loop *loop, struct daemon_state *state) {
+	int queued;
+	if (!state->tx_blocked)
+		return 0;
+	queued = tx_enqueue(state, state->tx_blocked, clock_time_us());
+	if (queued < 0)
+		return 0; /* still full */
+	state->tx_blocked = NULL;
+	ev_io_start(loop, &state->ev_state.read_host);
+	ev_feed_event(loop, &state->ev_state.read_host, 0);
+	return queued;
 }
 
 void host_device_ready(struct ev_loop *loop, ev_io *handle, int revents) {
-	(void) loop;
 	(void) revents; /* should always be EV_READ */
 	struct daemon_state *state = handle->data;
 
-	int poll_result = poll_host_device(state); /* fill TX queues */
+	uint64_t now = clock_time_us();
+	int poll_result = poll_host_device(loop, state); /* fill TX queues */
 	if (poll_result & POLL_NEW_MULTICAST)
-		awdl_send_multicast(loop, &state->ev_state.tx_mcast_timer, 0);
+		slot_engine_arm(&state->ev_state.slots, SLOT_EVENT_TX_MULTICAST, now);
 	if (poll_result & POLL_NEW_UNICAST)
-		awdl_send_unicast(loop, &state->ev_state.tx_timer, 0);
+		slot_engine_arm(&state->ev_state.slots, SLOT_EVENT_TX_UNICAST, now);
+}
+
+static void awdl_receive_data(const struct ether_header *hdr, const struct buf *payload, void *data) {
+	const struct io_state *io_state = data;
+	struct iovec iov[2];
+	iov[0].iov_base = (void *) hdr;
+	iov[0].iov_len = sizeof(struct ether_header);
+	iov[1].iov_base = (void *) buf_data(payload);
+	iov[1].iov_len = buf_len(payload);
+	host_send_iov(io_state, iov, 2);
 }
 
 void awdl_receive_frame(uint8_t *user, const struct pcap_pkthdr *hdr, const uint8_t *buf) {
-#define MAX_NUM_AMPDU 16 /* TODO lookup this constant from the standard */
 	struct daemon_state *state = (void *) user;
 	int result;
-	const struct buf *frame = buf_new_const(buf, hdr->caplen);
-	struct buf *data_arr[MAX_NUM_AMPDU];
-	struct buf **data = &data_arr[0];
-	result = awdl_rx(frame, &data, &state->awdl_state);
-	if (result == RX_OK) {
-		for (struct buf **data_start = &data_arr[0]; data_start < data; data_start++) {
-			host_send(&state->io, buf_data(*data_start), buf_len(*data_start));
-			buf_free(*data_start);
-		}
-	} else if (result < RX_OK) {
+	struct buf view;
+	const struct buf *frame = buf_init_const(&view, buf, hdr->caplen);
+	result = awdl_rx(frame, wlan_rx_time(&state->io, hdr, clock_time_us()), &state->awdl_state);
+	if (result < RX_OK) {
 		log_warn("unhandled frame (%d)", result);
-		dump_frame(state->dump, hdr, buf);
+		if (state->io.wlan_tstamp_nano) {
+			/* dump files use microseconds */
+			struct pcap_pkthdr dump_hdr = *hdr;
+			dump_hdr.ts.tv_usec /= 1000;
+			dump_frame(state->dump, &dump_hdr, buf);
+		} else {
+			dump_frame(state->dump, hdr, buf);
+		}
 		state->awdl_state.stats.rx_unknown++;
 	}
-	buf_free(frame);
 }
 
-int awdl_send_data(const struct buf *buf, const struct io_state *io_state,
-                   struct awdl_state *awdl_state, struct ieee80211_state *ieee80211_state) {
-	uint8_t awdl_data[65535];
-	int awdl_data_len;
-	uint16_t ethertype;
+/* Convert Ethernet frame in place to data frame ready for injection */
+static int awdl_prepare_data(struct buf *buf, struct awdl_state *awdl_state,
+                             struct ieee80211_state *ieee80211_state, struct awdl_peer *peer) {
+	uint8_t hdr_buf[AWDL_DATA_HDR_MAX_LEN];
+	const uint8_t *hdr;
+	int hdr_len;
 	struct ether_addr src, dst;
 	uint64_t now;
 	uint16_t period, slot, tu;
 
-	READ_BE16(buf, ETHER_ETHERTYPE_OFFSET, &ethertype);
 	READ_ETHER_ADDR(buf, ETHER_DST_OFFSET, &dst);
 	READ_ETHER_ADDR(buf, ETHER_SRC_OFFSET, &src);
 
-	buf_strip(buf, ETHER_LENGTH);
-	awdl_data_len = awdl_init_full_data_frame(awdl_data, &src, &dst,
-	                                          buf_data(buf), buf_len(buf),
-	                                          awdl_state, ieee80211_state);
+	if (peer) { /* reuse headers unless source has changed */
+		if (!awdl_data_hdr_matches(peer->data_hdr, peer->data_hdr_len, &src, &dst))
+			peer->data_hdr_len = awdl_init_data_hdr(peer->data_hdr, &src, &dst);
+		hdr = peer->data_hdr;
+		hdr_len = peer->data_hdr_len;
+	} else {
+		hdr_len = awdl_init_data_hdr(hdr_buf, &src, &dst);
+		hdr = hdr_buf;
+	}
+
+	if (awdl_encap_data(buf, hdr, hdr_len, awdl_state, ieee80211_state) < 0)
+		return TX_FAIL;
+
 	now = clock_time_us();
 	period = awdl_sync_current_eaw(now, &awdl_state->sync) / AWDL_CHANSEQ_LENGTH;
 	slot = awdl_sync_current_eaw(now, &awdl_state->sync) % AWDL_CHANSEQ_LENGTH;
 	tu = awdl_sync_next_aw_tu(now, &awdl_state->sync);
-	log_trace("Send data (len %d) to %s (%u.%u.%u)", awdl_data_len,
+	log_trace("Send data (len %d) to %s (%u.%u.%u)", buf_len(buf),
 	          ether_ntoa(&dst), period, slot, tu);
 	awdl_state->stats.tx_data++;
-	if (wlan_send(io_state, awdl_data, awdl_data_len) < 0)
-		return TX_FAIL;
 	return TX_OK;
 
 wire_error:
 	return TX_FAIL;
 }
 
-void awdl_send_action(struct daemon_state *state, enum awdl_action_type type) {
-	uint8_t buf[65535];
-	int len;
-
-	len = awdl_init_full_action_frame(buf, &state->awdl_state, &state->ieee80211_state, type);
-	if (len < 0)
+static void tx_batch_flush(struct daemon_state *state) {
+	struct tx_batch *batch = &state->tx_batch;
+	int sent;
+	if (!batch->num)
 		return;
+	sent = wlan_send_batch(&state->io, batch->frames, batch->num);
+	if (sent < batch->num) /* the rest was not handed to the kernel */
+		state->awdl_state.stats.tx_data_dropped += batch->num - (sent < 0 ? 0 : sent);
+	for (int i = 0; i < batch->num; i++)
+		buf_free(batch->bufs[i]);
+	batch->num = 0;
+}
+
+/* Takes ownership of {@code buf} which is sent with the next flush */
+static void tx_batch_add(struct daemon_state *state, struct buf *buf) {
+	struct tx_batch *batch = &state->tx_batch;
+	if (batch->num == WLAN_SEND_BATCH_MAX)
+		tx_batch_flush(state);
+	batch->frames[batch->num].iov_base = (void *) buf_data(buf);
+	batch->frames[batch->num].iov_len = buf_len(buf);
+	batch->bufs[batch->num] = buf;
+	batch->num++;
+}
+
+/* Batch next frames with the same destination from queue, aggregated as A-MSDU if they fit */
+static int awdl_send_queued(struct daemon_state *state, cbuf_handle_t queue, struct awdl_peer *peer) {
+	struct awdl_state *awdl_state = &state->awdl_state;
+	const struct buf *frames[AMSDU_MAX_SUBFRAMES];
+	struct buf *amsdu;
+	struct ether_addr dst, next_dst;
+	int num = 0, len = 0, amsdu_len;
+	void *next;
+
+	while (num < AMSDU_MAX_SUBFRAMES && !circular_buf_get(queue, &next, 1 /* peek */)) {
+		int next_len = ((len + 3) & ~3) + ETHER_HDR_LEN + awdl_amsdu_subframe_len(buf_len(next) - ETHER_HDR_LEN);
+		read_ether_addr(next, ETHER_DST_OFFSET, &next_dst);
+		if (num > 0 && (next_len > state->amsdu_max_len || compare_ether_addr(&dst, &next_dst)))
+			break;
+		circular_buf_get(queue, &next, 0);
+		frames[num++] = next;
+		dst = next_dst;
+		len = next_len;
+	}
+
+	if (num == 1) {
+		if (awdl_prepare_data((struct buf *) frames[0], awdl_state, &state->ieee80211_state, peer) == TX_OK)
+			tx_batch_add(state, (struct buf *) frames[0]);
+		else
+			buf_free(frames[0]);
+		return num;
+	}
+
+	if (num > 1) {
+		amsdu = buf_new_owned(AWDL_DATA_HDR_MAX_LEN + AWDL_AMSDU_MAX_LEN + AWDL_DATA_TAILROOM);
+		amsdu_len = awdl_init_full_amsdu_frame((uint8_t *) buf_data(amsdu), &awdl_state->self_address, &dst,
+		                                       frames, num, awdl_state, &state->ieee80211_state);
+		buf_take(amsdu, buf_len(amsdu) - amsdu_len);
+		log_trace("Send A-MSDU (len %d, %d subframes) to %s", amsdu_len, num, ether_ntoa(&dst));
+		awdl_state->stats.tx_data += num;
+		awdl_state->stats.tx_amsdu++;
+		awdl_state->stats.tx_amsdu_subframes += num;
+		tx_batch_add(state, amsdu);
+	}
+
+	for (int i = 0; i < num; i++)
+		buf_free(frames[i]);
+	return num;
+}
+
+/* Time (in us) by which we wake up ahead of action frames so that they can be queued with a launch time */
+static uint64_t awdl_txtime_lead(const struct daemon_state *state) {
+	return state->io.wlan_txtime ? state->txtime_lead : 0;
+}
+
+void awdl_send_action(struct daemon_state *state, enum awdl_action_type type, uint64_t at) {
+	struct awdl_action_template *tmpl;
+	uint64_t now = clock_time_us();
+	int len, queued = 0;
+
+	tmpl = type == AWDL_ACTION_MIF ? &state->mif_template : &state->psf_template;
 	log_trace("send %s", awdl_frame_as_str(type));
-	wlan_send(&state->io, buf, len);
+
+	/* timing fields describe the launch time, so they may only be advanced if it is honored */
+	if (at > now && wlan_txtime_usable(&state->io)) {
+		len = awdl_action_template_update(tmpl, &state->awdl_state, &state->ieee80211_state, at);
+		if (len < 0)
+			return;
+		queued = !wlan_send_at(&state->io, tmpl->buf, len, at);
+	}
+	if (!queued) { /* goes out right away */
+		len = awdl_action_template_update(tmpl, &state->awdl_state, &state->ieee80211_state, now);
+		if (len < 0)
+			return;
+		wlan_send(&state->io, tmpl->buf, len);
+	}
 
 	state->awdl_state.stats.tx_action++;
 }
 
-void awdl_send_psf(struct ev_loop *loop, ev_timer *handle, int revents) {
-	(void) loop;
-	(void) revents;
-	awdl_send_action(handle->data, AWDL_ACTION_PSF);
+uint64_t awdl_send_psf(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now) {
+	(void) slot;
+	uint64_t interval = ieee80211_tu_to_usec(state->awdl_state.psf_interval);
+	uint64_t lead = awdl_txtime_lead(state);
+	/* we are woken up ahead of the regular launch time if launch times are enabled */
+	uint64_t at = state->ev_state.slots.deadline[SLOT_EVENT_PSF] + lead;
+	uint64_t next = at + interval - lead; /* wake up ahead of the next launch time again */
+
+	awdl_send_action(state, AWDL_ACTION_PSF, at);
+
+	/* keep a fixed period unless we fell behind by more than an interval */
+	return next > now ? next : now + interval;
 }
 
-void awdl_send_mif(struct ev_loop *loop, ev_timer *timer, int revents) {
-	(void) revents;
-	struct daemon_state *state = timer->data;
+uint64_t awdl_send_mif(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now) {
 	struct awdl_state *awdl_state = &state->awdl_state;
-	uint64_t now, next_aw, eaw_len;
+	uint64_t mid = slot->start + (slot->end - slot->start) / 2;
+	uint64_t lead = awdl_txtime_lead(state);
 
-	now = clock_time_us();
-	next_aw = awdl_sync_next_aw_us(now, &awdl_state->sync);
-	eaw_len = awdl_state->sync.presence_mode * awdl_state->sync.aw_period;
+	if (now + lead < mid) /* first run */
+		return mid - lead;
 
 	/* Schedule MIF in middle of sequence (if non-zero) */
 	if (awdl_chan_num(awdl_state->channel.current, awdl_state->channel.enc) > 0)
-		awdl_send_action(state, AWDL_ACTION_MIF);
+		awdl_send_action(state, AWDL_ACTION_MIF, mid);
 
 	/* schedule next in the middle of EAW */
-	ev_timer_rearm(loop, timer, usec_to_sec(next_aw + ieee80211_tu_to_usec(eaw_len / 2)));
+	return slot->end + (slot->end - slot->start) / 2 - lead;
 }
 
-void awdl_send_unicast(struct ev_loop *loop, ev_timer *timer, int revents) {
-	(void) revents;
-	struct daemon_state *state = timer->data;
+uint64_t awdl_send_unicast(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now) {
 	struct awdl_state *awdl_state = &state->awdl_state;
-	uint64_t now = clock_time_us();
-	double in = 0;
-
-	if (state->next) { /* we have something to send */
-		struct awdl_peer *peer;
-		struct ether_addr dst;
-		read_ether_addr(state->next, ETHER_DST_OFFSET, &dst);
-		if (compare_ether_addr(&dst, &awdl_state->self_address) == 0) {
-			/* send back to self */
-			host_send(&state->io, buf_data(state->next), buf_len(state->next));
-			buf_free(state->next);
-			state->next = NULL;
-		} else if (awdl_peer_get(awdl_state->peers.peers, &dst, &peer) < 0) {
-			log_debug("Drop frame to non-peer %s", ether_ntoa(&dst));
-			buf_free(state->next);
-			state->next = NULL;
-		} else {
-			in = awdl_can_send_unicast_in(awdl_state, peer, now, AWDL_UNICAST_GUARD_TU);
-			if (in == 0) { /* send now */
-				awdl_send_data(state->next, &state->io, &state->awdl_state, &state->ieee80211_state);
-				buf_free(state->next);
-				state->next = NULL;
-				state->awdl_state.stats.tx_data_unicast++;
-			} else { /* try later */
-				if (in < 0) /* we are at the end of slot but within guard */
-					in = -in + usec_to_sec(ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
-			}
+	uint64_t next = 0; /* earliest retry, 0 if nothing is left */
+	struct awdl_peers_it it;
+	struct awdl_peer *peer;
+	int queued;
+
+	tx_release_held(state, now);
+
+	/* serve all peers that we can reach right now */
+	awdl_peers_it_init(&it, awdl_state->peers.peers);
+	while (awdl_peers_it_next(&it, &peer) == PEERS_OK) {
+		int64_t in;
+		int sent;
+		if (!peer->tx_queue || circular_buf_empty(peer->tx_queue))
+			continue;
+		in = awdl_can_send_unicast_in_us(awdl_state, peer, now, awdl_state->guard.unicast);
+		if (in == 0) { /* send now */
+			while ((sent = awdl_send_queued(state, peer->tx_queue, peer)) > 0)
+				awdl_state->stats.tx_data_unicast += sent;
+			continue;
 		}
+		if (in < 0) /* we are at the end of slot but within guard */
+			in = -in + awdl_state->guard.unicast;
+		if (!next || now + in < next)
+			next = now + in;
+	}
+	tx_batch_flush(state);
+
+	/* sending made room for the frame that blocked the host */
+	queued = tx_unblock(state->ev_state.loop, state);
+	if (queued & POLL_NEW_MULTICAST)
+		slot_engine_arm(&state->ev_state.slots, SLOT_EVENT_TX_MULTICAST, now);
+	if (queued & POLL_NEW_UNICAST)
+		next = now; /* run again to schedule it */
+
+	if (!circular_buf_empty(state->tx_queue_hold)) {
+		/* check again for discovered peers in next slot */
+		if (!next || slot->end < next)
+			next = slot->end;
 	}
 
 	/* rearm if more unicast frames available */
-	if (state->next) {
-		log_trace("awdl_send_unicast: retry in %lu TU", ieee80211_usec_to_tu(sec_to_usec(in)));
-		ev_timer_rearm(loop, timer, in);
-	} else {
-		/* poll for more frames to keep queue full */
-		ev_feed_event(loop, &state->ev_state.read_host, 0);
-	}
+	if (next)
+		log_trace("awdl_send_unicast: retry in %lu TU", ieee80211_usec_to_tu(next - now));
+	return next;
 }
 
-void awdl_send_multicast(struct ev_loop *loop, ev_timer *timer, int revents) {
-	(void) revents;
-	struct daemon_state *state = timer->data;
+uint64_t awdl_send_multicast(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now) {
 	struct awdl_state *awdl_state = &state->awdl_state;
-	uint64_t now = clock_time_us();
-	double in = 0;
+	uint64_t next = 0;
+	int queued;
 
 	if (!circular_buf_empty(state->tx_queue_multicast)) { /* we have something to send */
-		in = awdl_can_send_in(awdl_state, now, AWDL_MULTICAST_GUARD_TU);
+		int64_t in = awdl_can_send_in_us(awdl_state, now, awdl_state->guard.multicast);
 		if (awdl_is_multicast_eaw(awdl_state, now) && (in == 0)) { /* we can send now */
-			void *next;
-			circular_buf_get(state->tx_queue_multicast, &next, 0);
-			awdl_send_data((struct buf *) next, &state->io, &state->awdl_state, &state->ieee80211_state);
-			buf_free(next);
-			state->awdl_state.stats.tx_data_multicast++;
-		} else { /* try later */
-			if (in == 0) /* try again next EAW */
-				in = usec_to_sec(ieee80211_tu_to_usec(64));
-			else if (in < 0) /* we are at the end of slot but within guard */
-				in = -in + usec_to_sec(ieee80211_tu_to_usec(AWDL_MULTICAST_GUARD_TU));
+			int sent = awdl_send_queued(state, state->tx_queue_multicast, NULL);
+			state->awdl_state.stats.tx_data_multicast += sent;
+			tx_batch_flush(state);
+			next = now;
+		} else if (in == 0) { /* try again next EAW */
+			next = slot->end;
+		} else if (in < 0) { /* we are at the end of slot but within guard */
+			next = now - in + awdl_state->guard.multicast;
+		} else {
+			next = now + in;
 		}
 	}
 
+	/* sending made room for the frame that blocked the host */
+	queued = tx_unblock(state->ev_state.loop, state);
+	if (queued & POLL_NEW_UNICAST)
+		slot_engine_arm(&state->ev_state.slots, SLOT_EVENT_TX_UNICAST, now);
+	if (queued & POLL_NEW_MULTICAST)
+		next = now; /* run again to schedule it */
+
 	/* rearm if more multicast frames available */
-	if (!circular_buf_empty(state->tx_queue_multicast)) {
-		log_trace("awdl_send_multicast: retry in %lu TU", ieee80211_usec_to_tu(sec_to_usec(in)));
-		ev_timer_rearm(loop, timer, in);
-	} else {
-		/* poll for more frames to keep queue full */
-		ev_feed_event(loop, &state->ev_state.read_host, 0);
+	if (circular_buf_empty(state->tx_queue_multicast))
+		return 0;
+	log_trace("awdl_send_multicast: retry in %lu TU", ieee80211_usec_to_tu(next - now));
+	return next;
+}
+
+static void chan_switch_record(struct daemon_state *state, int chan_num, uint64_t latency, int err) {
+	struct chan_switch_state *cs = &state->chan_switch;
+	struct chan_switch_stats *stats = (chan_num <= CHAN_SWITCH_STATS_MAX) ? &cs->stats[chan_num] : NULL;
+
+	if (err) {
+		log_warn("could not switch to channel %d: %s", chan_num, strerror(-err));
+		if (stats)
+			stats->failures++;
+		/* make sure that we try again in the next slot on this channel unless we have moved on already */
+		if (awdl_chan_num(state->awdl_state.channel.current, state->awdl_state.channel.enc) == chan_num)
+			state->awdl_state.channel.current = CHAN_NULL;
+		return;
 	}
+
+	if (stats) {
+		stats->latency_total += latency;
+		if (latency > stats->latency_max)
+			stats->latency_max = latency;
+	}
+
+	awdl_guard_update(&state->awdl_state, latency ? latency : 1);
+
+	/* moving average of the switch latency determines how early we issue the next switch,
+	 * but we must not leave the current slot before its guard interval */
+	cs->lead = (7 * cs->lead + latency) / 8;
+	if (cs->lead > state->awdl_state.guard.unicast)
+		cs->lead = state->awdl_state.guard.unicast;
 }
 
-void awdl_switch_channel(struct ev_loop *loop, ev_timer *timer, int revents) {
-	(void) revents;
-	uint64_t now, next_aw;
-	int slot;
+static void chan_switch_done(uint32_t seq, int err, void *data) {
+	struct daemon_state *state = data;
+	struct chan_switch_state *cs = &state->chan_switch;
+
+	for (int i = 0; i < CHAN_SWITCH_PENDING_MAX; i++) {
+		if (!cs->pending[i].issued || cs->pending[i].seq != seq)
+			continue;
+		chan_switch_record(state, cs->pending[i].chan_num, clock_time_us() - cs->pending[i].issued, err);
+		cs->pending[i].issued = 0;
+		return;
+	}
+	log_trace("unexpected channel switch ack (seq %u)", seq);
+}
+
+static void chan_switch_ready(struct ev_loop *loop, ev_io *handle, int revents) {
+	(void) loop;
+	(void) revents; /* should always be EV_READ */
+	set_channel_async_process(chan_switch_done, handle->data);
+}
+
+static void awdl_set_channel(struct daemon_state *state, int chan_num) {
+	struct chan_switch_state *cs = &state->chan_switch;
+	uint64_t start = clock_time_us();
+	int err, slot = 0;
+
+	if (chan_num <= CHAN_SWITCH_STATS_MAX)
+		cs->stats[chan_num].requests++;
+
+	if (cs->fd < 0) {
+		err = set_channel(state->io.wlan_ifindex, chan_num);
+		chan_switch_record(state, chan_num, clock_time_us() - start, err < 0 ? err : 0);
+		return;
+	}
+
+	/* reuse the oldest request if none is free, its ack must have been lost */
+	for (int i = 0; i < CHAN_SWITCH_PENDING_MAX; i++) {
+		if (!cs->pending[i].issued) {
+			slot = i;
+			break;
+		}
+		if (cs->pending[i].issued < cs->pending[slot].issued)
+			slot = i;
+	}
+	if (cs->pending[slot].issued)
+		chan_switch_record(state, cs->pending[slot].chan_num, 0, -ETIMEDOUT);
+
+	err = set_channel_async(state->io.wlan_ifindex, chan_num, &cs->pending[slot].seq);
+	if (err < 0) {
+		cs->pending[slot].issued = 0;
+		chan_switch_record(state, chan_num, 0, err);
+		return;
+	}
+	cs->pending[slot].chan_num = chan_num;
+	cs->pending[slot].issued = start;
+}
+
+uint64_t awdl_switch_channel(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now) {
 	struct awdl_chan chan_new;
 	int chan_num_new, chan_num_old;
-	struct daemon_state *state = timer->data;
 	struct awdl_state *awdl_state = &state->awdl_state;
+	uint8_t index = slot->index;
+	uint64_t next_start = slot->end;
+
+	/* we are woken up ahead of the next slot to hide the switch latency */
+	if (slot->end - now < (slot->end - slot->start) / 2) {
+		index = (index + 1) % AWDL_CHANSEQ_LENGTH;
+		next_start = slot->end + (slot->end - slot->start);
+	}
 
 	chan_num_old = awdl_chan_num(awdl_state->channel.current, awdl_state->channel.enc);
 
-	now = clock_time_us();
-	slot = awdl_sync_current_eaw(now, &awdl_state->sync) % AWDL_CHANSEQ_LENGTH;
-	chan_new = awdl_state->channel.sequence[slot];
-	chan_num_new = awdl_chan_num(awdl_state->channel.sequence[slot], awdl_state->channel.enc);
+	chan_new = awdl_state->channel.sequence[index];
+	chan_num_new = awdl_chan_num(chan_new, awdl_state->channel.enc);
 
 	if (chan_num_new && (chan_num_new != chan_num_old)) {
-		log_debug("switch channel to %d (slot %d)", chan_num_new, slot);
+		log_debug("switch channel to %d (slot %d)", chan_num_new, index);
+		awdl_state->channel.current = chan_new;
 		if (!state->io.wlan_is_file) {
 			bool is_available;
-			is_channel_available(state->io.wlan_ifindex, chan_num_new, &is_available);
-			set_channel(state->io.wlan_ifindex, chan_num_new);
+			/* only consults the wiphy cache, try anyway if the cache is unusable */
+			if (is_channel_available(state->io.wlan_ifindex, chan_num_new, &is_available) < 0 || is_available)
+				awdl_set_channel(state, chan_num_new);
+			else
+				log_debug("channel %d is not available", chan_num_new);
 		}
-		awdl_state->channel.current = chan_new;
 	}
 
-	next_aw = awdl_sync_next_aw_us(now, &awdl_state->sync);
+	return next_start - state->chan_switch.lead;
+}
+
+typedef uint64_t (*awdl_slot_handler)(struct daemon_state *, const struct awdl_slot *, uint64_t);
+
+static void awdl_slot_dispatch(struct slot_engine *engine, uint64_t now, void *data) {
+	static const awdl_slot_handler handlers[SLOT_EVENT_MAX] = {
+		[SLOT_EVENT_CHAN] = awdl_switch_channel,
+		[SLOT_EVENT_PSF] = awdl_send_psf,
+		[SLOT_EVENT_MIF] = awdl_send_mif,
+		[SLOT_EVENT_TX_UNICAST] = awdl_send_unicast,
+		[SLOT_EVENT_TX_MULTICAST] = awdl_send_multicast,
+	};
+	struct daemon_state *state = data;
+	struct awdl_slot slot;
+
+	/* compute slot boundaries once so that all events agree on them */
+	awdl_slot_at(&state->awdl_state.sync, now, &slot);
+
+	for (int event = 0; event < SLOT_EVENT_MAX; event++) {
+		if (slot_engine_due(engine, event, now))
+			slot_engine_arm(engine, event, handlers[event](state, &slot, now));
+	}
+}
+
+/* Warn about channels in our sequence that we cannot inject on */
+static void awdl_check_channels(struct daemon_state *state) {
+	struct awdl_channel_state *channel = &state->awdl_state.channel;
+	int checked[AWDL_CHANSEQ_LENGTH];
+	int num_checked = 0;
+
+	for (int i = 0; i < AWDL_CHANSEQ_LENGTH; i++) {
+		int chan_num = awdl_chan_num(channel->sequence[i], channel->enc);
+		bool is_available, seen = false;
+		for (int j = 0; j < num_checked; j++)
+			seen |= checked[j] == chan_num;
+		if (!chan_num || seen)
+			continue;
+		checked[num_checked++] = chan_num;
+		if (is_channel_available(state->io.wlan_ifindex, chan_num, &is_available) < 0)
+			continue;
+		if (!is_available)
+			log_warn("Cannot inject frames on channel %d (HT40+), try setting a regulatory domain (`iw reg set <CC>`) "
+			         "or using a different channel (6, 49, or 149)", chan_num);
+	}
+}
 
-	ev_timer_rearm(loop, timer, usec_to_sec(next_aw));
+static void reg_events_ready(struct ev_loop *loop, ev_io *handle, int revents) {
+	(void) loop;
+	(void) handle;
+	(void) revents; /* should always be EV_READ */
+	reg_events_process();
 }
 
 static void awdl_neighbor_add(struct awdl_peer *p, void *_io_state) {
@@ -320,17 +726,30 @@ static void awdl_neighbor_remove(struct awdl_peer *p, void *_io_state) {
 void awdl_clean_peers(struct ev_loop *loop, ev_timer *timer, int revents) {
 	(void) loop;
 	(void) revents; /* should always be EV_TIMER */
-	uint64_t cutoff_time;
+	uint64_t now, cutoff_time, oldest, next;
 	struct daemon_state *state;
 
 	state = (struct daemon_state *) timer->data;
-	cutoff_time = clock_time_us() - state->awdl_state.peers.timeout;
+	now = clock_time_us();
+	cutoff_time = now - state->awdl_state.peers.timeout;
 
 	awdl_peers_remove(state->awdl_state.peers.peers, cutoff_time,
 	                  state->awdl_state.peer_remove_cb, state->awdl_state.peer_remove_cb_data);
 
-	/* TODO for now run election immediately after clean up; might consider seperate timer for this */
-	awdl_election_run(&state->awdl_state.election, &state->awdl_state.peers);
+	/* wake up when the next peer expires, but at least every clean_interval */
+	next = now + state->awdl_state.peers.clean_interval;
+	oldest = awdl_peers_oldest(state->awdl_state.peers.peers);
+	if (oldest != UINT64_MAX && oldest + state->awdl_state.peers.timeout < next)
+		next = oldest + state->awdl_state.peers.timeout;
+	if (next < now + PEERS_EXPIRY_RESOLUTION)
+		next = now + PEERS_EXPIRY_RESOLUTION;
+	timer->repeat = usec_to_sec(next - now);
+
+	/* election is updated on received frames, only need to act if our sync master has expired */
+	awdl_election_check(&state->awdl_state.election, &state->awdl_state.peers);
+
+	/* follow changes of the sync error even if we do not switch channels */
+	awdl_guard_update(&state->awdl_state, 0);
 
 	ev_timer_again(loop, timer);
 }
@@ -338,13 +757,37 @@ void awdl_clean_peers(struct ev_loop *loop, ev_timer *timer, int revents) {
 void awdl_print_stats(struct ev_loop *loop, ev_signal *handle, int revents) {
 	(void) loop;
 	(void) revents; /* should always be EV_TIMER */
-	struct awdl_stats *stats = &((struct daemon_state *) handle->data)->awdl_state.stats;
+	struct daemon_state *state = handle->data;
+	struct awdl_stats *stats = &state->awdl_state.stats;
+	struct slot_stats *slots = &state->ev_state.slots.stats;
 
 	log_info("STATISTICS");
-	log_info(" TX action %llu, data %llu, unicast %llu, multicast %llu",
-	         stats->tx_action, stats->tx_data, stats->tx_data_unicast, stats->tx_data_multicast);
+	log_info(" TX action %llu, data %llu, unicast %llu, multicast %llu, dropped %llu",
+	         stats->tx_action, stats->tx_data, stats->tx_data_unicast, stats->tx_data_multicast,
+	         stats->tx_data_dropped);
+	log_info(" TX A-MSDU %llu, subframes %llu", stats->tx_amsdu, stats->tx_amsdu_subframes);
+	log_info(" Timer wakeups %llu, late avg %llu us, max %llu us, >= 1 TU %llu",
+	         slots->wakeups, slots->wakeups ? slots->late_total / slots->wakeups : 0, slots->late_max,
+	         slots->late_tu);
 	log_info(" RX action %llu, data %llu, unknown %llu",
 	         stats->rx_action, stats->rx_data, stats->rx_unknown);
+	log_info(" Peers %d, rejected %llu, evicted %llu", awdl_peers_length(state->awdl_state.peers.peers),
+	         stats->peers_rejected, stats->peers_evicted);
+	for (int chan = 0; chan <= CHAN_SWITCH_STATS_MAX; chan++) {
+		struct chan_switch_stats *cs = &state->chan_switch.stats[chan];
+		uint64_t acked = cs->requests - cs->failures;
+		if (!cs->requests)
+			continue;
+		log_info(" Channel %d switches %llu, failed %llu, latency avg %llu us, max %llu us", chan,
+		         cs->requests, cs->failures, acked ? cs->latency_total / acked : 0, cs->latency_max);
+	}
+	log_info(" Channel switch lead %llu us", state->chan_switch.lead);
+	log_info(" Guard unicast %u us, multicast %u us (switch latency %u us, sync error %u us)",
+	         state->awdl_state.guard.unicast, state->awdl_state.guard.multicast,
+	         state->awdl_state.guard.switch_latency, state->awdl_state.sync.meas_err_avg);
+	log_info(" Sync frequency offset %d ppb%s", state->awdl_state.sync.freq_ppb,
+	         awdl_sync_is_holdover(clock_time_us(), &state->awdl_state.sync) ? " (holdover)" : "");
+	log_info(" TX delay %u us (%u samples)", state->awdl_state.sync.tx_delay, state->awdl_state.sync.tx_delay_samples);
 }
 
 int awdl_init(struct daemon_state *state, const char *wlan, const char *host, struct awdl_chan chan, const char *dump) {
@@ -364,33 +807,70 @@ int awdl_init(struct daemon_state *state, const char *wlan, const char *host, st
 		return err;
 
 	awdl_init_state(&state->awdl_state, hostname, &state->io.if_ether_addr, chan, clock_time_us());
+	state->awdl_state.data_cb = awdl_receive_data;
+	state->awdl_state.data_cb_data = (void *) &state->io;
 	state->awdl_state.peer_cb = awdl_neighbor_add;
 	state->awdl_state.peer_cb_data = (void *) &state->io;
 	state->awdl_state.peer_remove_cb = awdl_neighbor_remove;
 	state->awdl_state.peer_remove_cb_data = (void *) &state->io;
 	ieee80211_init_state(&state->ieee80211_state);
+	awdl_action_template_init(&state->psf_template, AWDL_ACTION_PSF);
+	awdl_action_template_init(&state->mif_template, AWDL_ACTION_MIF);
 
-	state->next = NULL;
-	state->tx_queue_multicast = circular_buf_init(16);
+	state->tx_blocked = NULL;
+	state->tx_queue_multicast = circular_buf_init(TX_QUEUE_MULTICAST_LEN);
+	state->tx_queue_hold = circular_buf_init(TX_QUEUE_HOLD_LEN);
 	state->dump = dump;
+	state->rx_batch_frames = RX_BATCH_FRAMES_DEFAULT;
+	state->rx_batch_usec = RX_BATCH_USEC_DEFAULT;
+	state->amsdu_max_len = AWDL_AMSDU_DEFAULT_LEN;
+	state->tx_batch.num = 0;
+	state->ev_state.slots.loop = NULL; /* set up in awdl_schedule() */
+	memset(&state->chan_switch, 0, sizeof(state->chan_switch));
+	state->chan_switch.fd = -1; /* set up in awdl_schedule() */
+	state->chan_switch.lead = CHAN_SWITCH_LEAD_DEFAULT;
+	state->txtime_lead = TXTIME_LEAD_DEFAULT;
+
+	if (!state->io.wlan_is_file) {
+		err = wiphy_cache_refresh(state->io.wlan_ifindex);
+		if (err < 0)
+			log_warn("Could not read channel capabilities");
+		else
+			awdl_check_channels(state);
+	}
 
 	return 0;
 }
 
 void awdl_free(struct daemon_state *state) {
+	void *next;
+	if (state->tx_blocked)
+		buf_free(state->tx_blocked);
+	while (!circular_buf_get(state->tx_queue_multicast, &next, 0))
+		buf_free(next);
 	circular_buf_free(state->tx_queue_multicast);
+	while (!circular_buf_get(state->tx_queue_hold, &next, 0)) {
+		buf_free(((struct tx_held *) next)->buf);
+		free(next);
+	}
+	circular_buf_free(state->tx_queue_hold);
+	slot_engine_free(&state->ev_state.slots);
 	io_state_free(&state->io);
 	netutils_cleanup();
 }
 
 void awdl_schedule(struct ev_loop *loop, struct daemon_state *state) {
 
+	uint64_t now = clock_time_us();
+
 	state->ev_state.loop = loop;
 
-	/* Timer for channel switching */
-	state->ev_state.chan_timer.data = (void *) state;
-	ev_timer_init(&state->ev_state.chan_timer, awdl_switch_channel, 0, 0);
-	ev_timer_start(loop, &state->ev_state.chan_timer);
+	/* Single timer for channel switching, action frames, and data transmission */
+	slot_engine_init(&state->ev_state.slots, loop, awdl_slot_dispatch, state);
+	slot_engine_arm(&state->ev_state.slots, SLOT_EVENT_CHAN, now);
+	slot_engine_arm(&state->ev_state.slots, SLOT_EVENT_PSF,
+	                now + ieee80211_tu_to_usec(state->awdl_state.psf_interval) - awdl_txtime_lead(state));
+	slot_engine_arm(&state->ev_state.slots, SLOT_EVENT_MIF, now);
 
 	/* Timer for peer table cleanup */
 	state->ev_state.peer_timer.data = (void *) state;
@@ -401,34 +881,36 @@ void awdl_schedule(struct ev_loop *loop, struct daemon_state *state) {
 	state->ev_state.read_wlan.data = (void *) state;
 	ev_io_init(&state->ev_state.read_wlan, wlan_device_ready, state->io.wlan_fd, EV_READ);
 	ev_io_start(loop, &state->ev_state.read_wlan);
+	state->ev_state.read_wlan_idle.data = (void *) state;
+	ev_idle_init(&state->ev_state.read_wlan_idle, wlan_device_idle);
+
+	/* Receive acks of asynchronous channel switches */
+	if (!state->io.wlan_is_file) {
+		state->chan_switch.fd = set_channel_async_init();
+		if (state->chan_switch.fd >= 0) {
+			state->ev_state.chan_switch.data = (void *) state;
+			ev_io_init(&state->ev_state.chan_switch, chan_switch_ready, state->chan_switch.fd, EV_READ);
+			ev_io_start(loop, &state->ev_state.chan_switch);
+		} else {
+			log_warn("Could not set up asynchronous channel switching, falling back to blocking requests");
+		}
+	}
+
+	/* Refresh channel capabilities on regulatory changes */
+	if (!state->io.wlan_is_file) {
+		int fd = reg_events_init();
+		if (fd >= 0) {
+			state->ev_state.reg_events.data = (void *) state;
+			ev_io_init(&state->ev_state.reg_events, reg_events_ready, fd, EV_READ);
+			ev_io_start(loop, &state->ev_state.reg_events);
+		}
+	}
 
 	/* Trigger frame reception from host device */
 	state->ev_state.read_host.data = (void *) state;
 	ev_io_init(&state->ev_state.read_host, host_device_ready, state->io.host_fd, EV_READ);
 	ev_io_start(loop, &state->ev_state.read_host);
 
-	/* Timer for PSFs */
-	state->ev_state.psf_timer.data = (void *) state;
-	ev_timer_init(&state->ev_state.psf_timer, awdl_send_psf,
-	              usec_to_sec(ieee80211_tu_to_usec(state->awdl_state.psf_interval)),
-	              usec_to_sec(ieee80211_tu_to_usec(state->awdl_state.psf_interval)));
-	ev_timer_start(loop, &state->ev_state.psf_timer);
-
-	/* Timer for MIFs */
-	state->ev_state.mif_timer.data = (void *) state;
-	ev_timer_init(&state->ev_state.mif_timer, awdl_send_mif, 0, 0);
-	ev_timer_start(loop, &state->ev_state.mif_timer);
-
-	/* Timer for unicast packets */
-	state->ev_state.tx_timer.data = (void *) state;
-	ev_timer_init(&state->ev_state.tx_timer, awdl_send_unicast, 0, 0);
-	ev_timer_start(loop, &state->ev_state.tx_timer);
-
-	/* Timer for multicast packets */
-	state->ev_state.tx_mcast_timer.data = (void *) state;
-	ev_timer_init(&state->ev_state.tx_mcast_timer, awdl_send_multicast, 0, 0);
-	ev_timer_start(loop, &state->ev_state.tx_mcast_timer);
-
 	/* Register signal to print statistics */
 	state->ev_state.stats.data = (void *) state;
 	ev_signal_init(&state->ev_state.stats, awdl_print_stats, SIGSTATS);
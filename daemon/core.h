@@ -26,22 +26,68 @@
 #include "state.h"
 #include "circular_buffer.h"
 #include "io.h"
+#include "tx.h"
+#include "schedule.h"
+#include "slot.h"
 
 struct ev_state {
 	struct ev_loop *loop;
-	ev_timer mif_timer, psf_timer, tx_timer, tx_mcast_timer, chan_timer, peer_timer;
-	ev_io read_wlan, read_host;
+	struct slot_engine slots;
+	ev_timer peer_timer;
+	ev_io read_wlan, read_host, reg_events, chan_switch;
+	ev_idle read_wlan_idle;
 	ev_signal stats;
 };
 
+#define TXTIME_LEAD_DEFAULT 1000 /* in us */
+#define TXTIME_LEAD_MAX 16384 /* in us, a quarter slot, so that we wake up within the slot of the MIF */
+
+#define CHAN_SWITCH_PENDING_MAX 4
+#define CHAN_SWITCH_STATS_MAX 196 /* highest channel number we keep statistics for */
+
+struct chan_switch_stats {
+	uint64_t requests;
+	uint64_t failures;
+	uint64_t latency_total; /* in us, of acknowledged switches */
+	uint64_t latency_max;
+};
+
+struct chan_switch_state {
+	int fd; /* nl80211 socket for asynchronous switches, -1 if switching synchronously */
+	uint64_t lead; /* estimated switch latency in us, switches are issued this much before the slot starts */
+	struct {
+		uint32_t seq;
+		int chan_num;
+		uint64_t issued; /* 0 if unused */
+	} pending[CHAN_SWITCH_PENDING_MAX];
+	struct chan_switch_stats stats[CHAN_SWITCH_STATS_MAX + 1];
+};
+
+/* Frames to be injected with a single call */
+struct tx_batch {
+	struct iovec frames[WLAN_SEND_BATCH_MAX];
+	struct buf *bufs[WLAN_SEND_BATCH_MAX];
+	int num;
+};
+
 struct daemon_state {
 	struct io_state io;
 	struct awdl_state awdl_state;
 	struct ieee80211_state ieee80211_state;
 	struct ev_state ev_state;
-	struct buf *next;
+	struct buf *tx_blocked; /* frame read from host that did not fit into its queue */
 	cbuf_handle_t tx_queue_multicast;
+	cbuf_handle_t tx_queue_hold; /* unicast frames to peers that are still being discovered */
 	const char *dump;
+	struct awdl_action_template psf_template;
+	struct awdl_action_template mif_template;
+	/* budget for draining the WLAN device in a single wakeup */
+	int rx_batch_frames;
+	uint64_t rx_batch_usec;
+	int amsdu_max_len; /* 0 disables A-MSDU aggregation */
+	struct tx_batch tx_batch;
+	struct chan_switch_state chan_switch;
+	uint64_t txtime_lead; /* with launch times, action frames are handed to the kernel this much (in us) ahead */
 };
 
 int awdl_init(struct daemon_state *state, const char *wlan, const char *host, struct awdl_chan chan, const char *dump);
@@ -52,24 +98,25 @@ void awdl_schedule(struct ev_loop *loop, struct daemon_state *state);
 
 void wlan_device_ready(struct ev_loop *loop, ev_io *handle, int revents);
 
+void wlan_device_idle(struct ev_loop *loop, ev_idle *handle, int revents);
+
 void host_device_ready(struct ev_loop *loop, ev_io *handle, int revents);
 
 void awdl_receive_frame(uint8_t *user, const struct pcap_pkthdr *hdr, const uint8_t *buf);
 
-void awdl_send_action(struct daemon_state *state, enum awdl_action_type type);
-
-void awdl_send_psf(struct ev_loop *loop, ev_timer *handle, int revents);
+/* Send action frame, at {@code at} (in us) if launch times are enabled, right away otherwise */
+void awdl_send_action(struct daemon_state *state, enum awdl_action_type type, uint64_t at);
 
-void awdl_send_mif(struct ev_loop *loop, ev_timer *handle, int revents);
+/* Slot engine handlers, return the absolute time (in us) they should run next or 0 */
+uint64_t awdl_send_psf(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now);
 
-void awdl_send_unicast(struct ev_loop *loop, ev_timer *timer, int revents);
+uint64_t awdl_send_mif(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now);
 
-void awdl_send_multicast(struct ev_loop *loop, ev_timer *timer, int revents);
+uint64_t awdl_send_unicast(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now);
 
-int awdl_send_data(const struct buf *buf, const struct io_state *io_state,
-                   struct awdl_state *awdl_state, struct ieee80211_state *ieee80211_state);
+uint64_t awdl_send_multicast(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now);
 
-void awdl_switch_channel(struct ev_loop *loop, ev_timer *handle, int revents);
+uint64_t awdl_switch_channel(struct daemon_state *state, const struct awdl_slot *slot, uint64_t now);
 
 void awdl_clean_peers(struct ev_loop *loop, ev_timer *timer, int revents);
 
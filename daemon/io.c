@@ -17,15 +17,29 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sendmmsg */
+#endif
+
 #include <errno.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <time.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
 #ifndef __APPLE__
 #include <linux/if_tun.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <net/ethernet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #else
 #include <sys/sys_domain.h>
 #include <sys/kern_control.h>
@@ -59,6 +73,10 @@ static int open_nonblocking_device(const char *dev, pcap_t **pcap_handle, const
 #endif /* __APPLE__ */
 
 	pcap_set_timeout(handle, 1);
+#ifdef PCAP_TSTAMP_PRECISION_NANO
+	/* best effort, see wlan_rx_time() */
+	pcap_set_tstamp_precision(handle, PCAP_TSTAMP_PRECISION_NANO);
+#endif /* PCAP_TSTAMP_PRECISION_NANO */
 
 	if (pcap_activate(handle) < 0) {
 		log_error("pcap: unable to activate device %s (%s)", dev, pcap_geterr(handle));
@@ -104,6 +122,366 @@ static int open_nonblocking_device(const char *dev, pcap_t **pcap_handle, const
 	return fd;
 }
 
+static int filter_drop_all(pcap_t *handle) {
+	struct bpf_insn drop = BPF_STMT(BPF_RET | BPF_K, 0);
+	struct bpf_program filter = { 1, &drop };
+	return pcap_setfilter(handle, &filter);
+}
+
+#ifndef __APPLE__
+
+#define RX_RING_BLOCK_SIZE (1 << 18)
+#define RX_RING_BLOCK_NR 16
+#define RX_RING_FRAME_SIZE (1 << 11)
+#define RX_RING_BLOCK_TIMEOUT 1 /* in ms */
+
+static int rx_ring_attach_filter(int fd, const struct ether_addr *bssid_filter) {
+	pcap_t *dead;
+	struct bpf_program filter;
+	struct sock_fprog fprog;
+	char filter_str[128];
+	int err = 0;
+
+	/* Compile the same filter as for the pcap handle, the kernel runs classic BPF either way */
+	dead = pcap_open_dead(DLT_IEEE802_11_RADIO, 65535);
+	snprintf(filter_str, sizeof(filter_str), "wlan addr3 %s", ether_ntoa(bssid_filter));
+	if (pcap_compile(dead, &filter, filter_str, 1, PCAP_NETMASK_UNKNOWN) == -1) {
+		log_error("ring: could not create filter (%s)", pcap_geterr(dead));
+		pcap_close(dead);
+		return -EINVAL;
+	}
+
+	fprog.len = filter.bf_len;
+	fprog.filter = (struct sock_filter *) filter.bf_insns;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+		err = -errno;
+		log_error("ring: could not attach filter (%s)", strerror(errno));
+	}
+
+	pcap_freecode(&filter);
+	pcap_close(dead);
+	return err;
+}
+
+static int open_rx_ring(struct rx_ring *ring, int ifindex, const struct ether_addr *bssid_filter) {
+	int fd, err;
+	int version = TPACKET_V3;
+	struct tpacket_req3 req;
+	struct sockaddr_ll ll;
+	void *map;
+
+	/* protocol 0: do not receive anything until bound to the interface */
+	fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (fd < 0) {
+		log_warn("ring: unable to open packet socket (%s)", strerror(errno));
+		return -errno;
+	}
+
+	/* attach filter before binding to not queue any unfiltered frames */
+	if ((err = rx_ring_attach_filter(fd, bssid_filter)) < 0)
+		goto error;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		err = -errno;
+		log_warn("ring: TPACKET_V3 not supported (%s)", strerror(errno));
+		goto error;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RX_RING_BLOCK_SIZE;
+	req.tp_block_nr = RX_RING_BLOCK_NR;
+	req.tp_frame_size = RX_RING_FRAME_SIZE;
+	req.tp_frame_nr = (RX_RING_BLOCK_SIZE / RX_RING_FRAME_SIZE) * RX_RING_BLOCK_NR;
+	req.tp_retire_blk_tov = RX_RING_BLOCK_TIMEOUT;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		err = -errno;
+		log_warn("ring: unable to set up RX ring (%s)", strerror(errno));
+		goto error;
+	}
+
+	map = mmap(NULL, req.tp_block_size * req.tp_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		err = -errno;
+		log_warn("ring: unable to map RX ring (%s)", strerror(errno));
+		goto error;
+	}
+
+	memset(&ll, 0, sizeof(ll));
+	ll.sll_family = AF_PACKET;
+	ll.sll_protocol = htons(ETH_P_ALL);
+	ll.sll_ifindex = ifindex;
+	if (bind(fd, (struct sockaddr *) &ll, sizeof(ll)) < 0) {
+		err = -errno;
+		log_warn("ring: unable to bind to interface (%s)", strerror(errno));
+		munmap(map, req.tp_block_size * req.tp_block_nr);
+		goto error;
+	}
+
+	ring->fd = fd;
+	ring->map = map;
+	ring->map_len = req.tp_block_size * req.tp_block_nr;
+	ring->block_size = req.tp_block_size;
+	ring->block_nr = req.tp_block_nr;
+	ring->block = 0;
+	ring->pkts_left = 0;
+	ring->pkt = NULL;
+
+	return fd;
+error:
+	close(fd);
+	return err;
+}
+
+#define TX_RING_FRAME_SIZE (1 << 13) /* fits maximum A-MSDU */
+#define TX_RING_FRAME_NR 64
+#define TX_RING_BLOCK_SIZE (1 << 16)
+#define TX_RING_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+static int open_tx_socket(struct tx_ring *ring, int ifindex, int *use_ring) {
+	int fd, err;
+	int version = TPACKET_V2;
+	struct tpacket_req req;
+	struct sockaddr_ll ll;
+	void *map;
+
+	fd = socket(AF_PACKET, SOCK_RAW, 0); /* protocol 0: do not receive anything */
+	if (fd < 0) {
+		log_warn("tx: unable to open packet socket (%s)", strerror(errno));
+		return -errno;
+	}
+
+	memset(&ll, 0, sizeof(ll));
+	ll.sll_family = AF_PACKET;
+	ll.sll_ifindex = ifindex;
+
+	if (*use_ring) {
+		memset(&req, 0, sizeof(req));
+		req.tp_block_size = TX_RING_BLOCK_SIZE;
+		req.tp_frame_size = TX_RING_FRAME_SIZE;
+		req.tp_frame_nr = TX_RING_FRAME_NR;
+		req.tp_block_nr = TX_RING_FRAME_NR / (TX_RING_BLOCK_SIZE / TX_RING_FRAME_SIZE);
+		if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+		    setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+			log_warn("tx: unable to set up TX ring, using sendmmsg (%s)", strerror(errno));
+			*use_ring = 0;
+		} else {
+			map = mmap(NULL, req.tp_block_size * req.tp_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED) {
+				err = -errno;
+				log_warn("tx: unable to map TX ring (%s)", strerror(errno));
+				goto error;
+			}
+			ring->map = map;
+			ring->map_len = req.tp_block_size * req.tp_block_nr;
+			ring->frame_size = req.tp_frame_size;
+			ring->frame_nr = req.tp_frame_nr;
+			ring->frame = 0;
+		}
+	}
+
+	if (bind(fd, (struct sockaddr *) &ll, sizeof(ll)) < 0) {
+		err = -errno;
+		log_warn("tx: unable to bind to interface (%s)", strerror(errno));
+		if (*use_ring)
+			munmap(ring->map, ring->map_len);
+		goto error;
+	}
+
+	return fd;
+error:
+	close(fd);
+	return err;
+}
+
+static int tx_socket_send(int fd, const struct iovec *frames, int num) {
+	struct mmsghdr msgs[WLAN_SEND_BATCH_MAX];
+	int sent = 0;
+
+	memset(msgs, 0, num * sizeof(struct mmsghdr));
+	for (int i = 0; i < num; i++) {
+		msgs[i].msg_hdr.msg_iov = (struct iovec *) &frames[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	while (sent < num) {
+		int result = sendmmsg(fd, msgs + sent, num - sent, 0);
+		if (result < 0) {
+			log_error("tx: unable to send frames (%s)", strerror(errno));
+			return sent ? sent : -errno;
+		}
+		sent += result;
+	}
+	return sent;
+}
+
+#ifdef SO_TXTIME
+/* Let the kernel release frames at a given time, which is only honored by an ETF qdisc on the interface */
+static int tx_socket_enable_txtime(int fd, int ifindex) {
+	struct sock_txtime txtime = { .clockid = CLOCK_TAI, .flags = SOF_TXTIME_REPORT_ERRORS };
+	int err;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+		log_warn("tx: unable to enable SO_TXTIME (%s)", strerror(errno));
+		return -errno;
+	}
+	/* without ETF, the socket option is accepted but frames go out right away */
+	err = link_has_qdisc(ifindex, "etf");
+	if (err <= 0) {
+		log_warn("tx: no ETF qdisc found, launch times would be ignored (see tc-etf(8))");
+		return err < 0 ? err : -ENOENT;
+	}
+	return 0;
+}
+
+/* Returns the number of frames the kernel dropped instead of sending them at their launch time */
+static int tx_socket_txtime_errors(int fd) {
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int dropped = 0;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break; /* EAGAIN: error queue is empty */
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			const struct sock_extended_err *ee = (const struct sock_extended_err *) CMSG_DATA(cmsg);
+			if (cmsg->cmsg_level == SOL_PACKET && cmsg->cmsg_type == PACKET_TX_TIMESTAMP &&
+			    ee->ee_origin == SO_EE_ORIGIN_TXTIME)
+				dropped++;
+		}
+	}
+	return dropped;
+}
+
+/* Send a single frame with a launch time, {@code at} is on the monotonic clock in us */
+static int tx_socket_send_at(int fd, const struct iovec *frame, uint64_t at) {
+	char control[CMSG_SPACE(sizeof(uint64_t))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct timespec mono, tai;
+	uint64_t now, txtime;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &mono) || clock_gettime(CLOCK_TAI, &tai))
+		return -errno;
+	now = (uint64_t) mono.tv_sec * 1000000 + mono.tv_nsec / 1000;
+	if (at <= now)
+		return tx_socket_send(fd, frame, 1); /* too late already */
+	txtime = (uint64_t) tai.tv_sec * 1000000000 + tai.tv_nsec + (at - now) * 1000;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec *) frame;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_TXTIME;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+	memcpy(CMSG_DATA(cmsg), &txtime, sizeof(uint64_t));
+
+	if (sendmsg(fd, &msg, 0) < 0)
+		return -errno;
+	return 1;
+}
+#endif /* SO_TXTIME */
+
+/* Wait until the kernel has released {@code hdr}, returns 0 if the slot can be filled */
+static int tx_ring_reclaim(int fd, struct tpacket2_hdr *hdr) {
+	for (int waited = 0;; waited = 1) {
+		__sync_synchronize();
+		if (hdr->tp_status == TP_STATUS_AVAILABLE)
+			return 0;
+		if (hdr->tp_status & TP_STATUS_WRONG_FORMAT) {
+			/* the kernel stops at a malformed frame, skip it so that the ring drains again */
+			log_warn("tx: kernel rejected frame in TX ring");
+			hdr->tp_status = TP_STATUS_AVAILABLE;
+			return 0;
+		}
+		if (waited)
+			return -EAGAIN; /* frame is still in flight */
+		/* ring is full, wait until the kernel has sent the queued frames */
+		if (send(fd, NULL, 0, 0) < 0 && errno != EINVAL)
+			return -errno; /* EINVAL is returned for malformed frames, handled above */
+	}
+}
+
+static int tx_ring_send(struct tx_ring *ring, int fd, const struct iovec *frames, int num) {
+	int sent = 0, err = 0;
+
+	for (int i = 0; i < num; i++) {
+		struct tpacket2_hdr *hdr = (struct tpacket2_hdr *) (ring->map + ring->frame * ring->frame_size);
+
+		if (frames[i].iov_len > ring->frame_size - TX_RING_DATA_OFFSET) {
+			log_warn("tx: frame too large for TX ring (%zu)", frames[i].iov_len);
+			continue;
+		}
+		err = tx_ring_reclaim(fd, hdr);
+		if (err < 0) {
+			log_error("tx: TX ring is full (%s)", strerror(-err));
+			break;
+		}
+		memcpy((uint8_t *) hdr + TX_RING_DATA_OFFSET, frames[i].iov_base, frames[i].iov_len);
+		hdr->tp_len = frames[i].iov_len;
+		__sync_synchronize();
+		hdr->tp_status = TP_STATUS_SEND_REQUEST;
+		ring->frame = (ring->frame + 1) % ring->frame_nr;
+		sent++;
+	}
+
+	/* kick off transmission of all queued frames */
+	if (sent && send(fd, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != EINVAL) {
+		log_error("tx: unable to flush TX ring (%s)", strerror(errno));
+		return -errno;
+	}
+	return sent ? sent : err;
+}
+
+static void close_rx_ring(struct rx_ring *ring) {
+	munmap(ring->map, ring->map_len);
+	close(ring->fd);
+}
+
+static int rx_ring_dispatch(struct rx_ring *ring, int cnt, pcap_handler cb, uint8_t *user) {
+	int n = 0;
+
+	while (n < cnt) {
+		struct tpacket_block_desc *desc = (struct tpacket_block_desc *) (ring->map + ring->block * ring->block_size);
+
+		if (!ring->pkt) { /* open next block */
+			if (!(desc->hdr.bh1.block_status & TP_STATUS_USER))
+				break; /* kernel still owns this block */
+			__sync_synchronize();
+			ring->pkts_left = desc->hdr.bh1.num_pkts;
+			ring->pkt = (const uint8_t *) desc + desc->hdr.bh1.offset_to_first_pkt;
+		}
+
+		/* frames are handed out directly from the ring, no copy */
+		for (; ring->pkts_left > 0 && n < cnt; ring->pkts_left--, n++) {
+			const struct tpacket3_hdr *tp = (const struct tpacket3_hdr *) ring->pkt;
+			struct pcap_pkthdr hdr;
+			hdr.ts.tv_sec = tp->tp_sec;
+			hdr.ts.tv_usec = tp->tp_nsec; /* always nanoseconds, see wlan_tstamp_nano */
+			hdr.caplen = tp->tp_snaplen;
+			hdr.len = tp->tp_len;
+			cb(user, &hdr, ring->pkt + tp->tp_mac);
+			ring->pkt += tp->tp_next_offset;
+		}
+
+		if (!ring->pkts_left) { /* return whole block to kernel */
+			__sync_synchronize();
+			desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+			ring->pkt = NULL;
+			ring->block = (ring->block + 1) % ring->block_nr;
+		}
+	}
+
+	return n;
+}
+
+#endif /* __APPLE__ */
+
 static int open_savefile(const char *filename, pcap_t **pcap_handle) {
 	char errbuf[PCAP_ERRBUF_SIZE];
 	int fd;
@@ -266,7 +644,12 @@ static int io_state_init_wlan_try_savefile(struct io_state *state) {
 	if ((err = state->wlan_fd) < 0)
 		return err;
 	state->wlan_is_file = 1;
+	state->wlan_tstamp_nano = 0;
+	state->wlan_txtime = 0;
 	state->wlan_ifindex = 0;
+	state->wlan_rx_ring = 0;
+	state->wlan_tx_socket = 0;
+	state->wlan_tx_ring = 0;
 
 	return 0;
 }
@@ -276,6 +659,8 @@ static int io_state_init_wlan(struct io_state *state, const char *wlan, const st
 
 	strcpy(state->wlan_ifname, wlan);
 	state->wlan_is_file = 0;
+	state->wlan_tstamp_nano = 0;
+	state->tx_ring = NULL;
 
 	if (!io_state_init_wlan_try_savefile(state)) {
 		log_info("Using savefile instead of device");
@@ -309,6 +694,71 @@ static int io_state_init_wlan(struct io_state *state, const char *wlan, const st
 		log_error("Could not open device: %s", state->wlan_ifname);
 		return err;
 	}
+#ifdef PCAP_TSTAMP_PRECISION_NANO
+	state->wlan_tstamp_nano = pcap_get_tstamp_precision(state->wlan_handle) == PCAP_TSTAMP_PRECISION_NANO;
+#endif /* PCAP_TSTAMP_PRECISION_NANO */
+	if (state->wlan_rx_ring) {
+#ifndef __APPLE__
+		int fd = open_rx_ring(&state->rx_ring, state->wlan_ifindex, bssid_filter);
+		if (fd < 0) {
+			log_warn("Could not set up RX ring on %s, falling back to pcap", state->wlan_ifname);
+			state->wlan_rx_ring = 0;
+		} else {
+			/* keep pcap handle for injection only */
+			if (filter_drop_all(state->wlan_handle) == -1)
+				log_warn("pcap: could not disable capturing (%s)", pcap_geterr(state->wlan_handle));
+			state->wlan_fd = fd;
+			state->wlan_tstamp_nano = 1;
+			log_debug("Using RX ring on %s", state->wlan_ifname);
+		}
+#else
+		log_warn("RX ring is not supported on this platform, using pcap");
+		state->wlan_rx_ring = 0;
+#endif /* __APPLE__ */
+	}
+	if (state->wlan_tx_socket || state->wlan_tx_ring || state->wlan_txtime) {
+#ifndef __APPLE__
+		state->wlan_tx_socket = 1;
+		if (state->wlan_tx_ring && !(state->tx_ring = calloc(1, sizeof(struct tx_ring))))
+			state->wlan_tx_ring = 0;
+		state->wlan_tx_fd = open_tx_socket(state->tx_ring, state->wlan_ifindex, &state->wlan_tx_ring);
+		if (state->wlan_tx_fd < 0) {
+			log_warn("Could not set up packet socket on %s, falling back to pcap", state->wlan_ifname);
+			state->wlan_tx_socket = 0;
+			state->wlan_tx_ring = 0;
+			state->wlan_txtime = 0;
+		} else {
+			log_debug("Using packet socket%s for injection on %s", state->wlan_tx_ring ? " with TX ring" : "",
+			          state->wlan_ifname);
+		}
+		if (!state->wlan_tx_ring) {
+			free(state->tx_ring);
+			state->tx_ring = NULL;
+		}
+#else
+		log_warn("Packet socket is not supported on this platform, using pcap");
+		state->wlan_tx_socket = 0;
+		state->wlan_tx_ring = 0;
+		state->wlan_txtime = 0;
+#endif /* __APPLE__ */
+	}
+	if (state->wlan_txtime) {
+#ifdef SO_TXTIME
+		if (state->wlan_tx_ring) {
+			/* sendmsg() on a socket with TX ring sends from the ring, without launch time */
+			log_warn("Launch times are not supported with TX ring, sending immediately");
+			state->wlan_txtime = 0;
+		} else if (tx_socket_enable_txtime(state->wlan_tx_fd, state->wlan_ifindex) < 0) {
+			log_warn("Could not enable launch times on %s, sending immediately", state->wlan_ifname);
+			state->wlan_txtime = 0;
+		} else {
+			log_debug("Using launch times for action frames on %s", state->wlan_ifname);
+		}
+#else
+		log_warn("SO_TXTIME is not supported on this platform, sending immediately");
+		state->wlan_txtime = 0;
+#endif /* SO_TXTIME */
+	}
 	err = link_ether_addr_get(state->wlan_ifname, &state->if_ether_addr);
 	if (err < 0) {
 		log_error("Could not get LLC address from %s", state->wlan_ifname);
@@ -355,19 +805,107 @@ int io_state_init(struct io_state *state, const char *wlan, const char *host, co
 
 void io_state_free(struct io_state *state) {
 	close(state->host_fd);
+#ifndef __APPLE__
+	if (state->wlan_rx_ring)
+		close_rx_ring(&state->rx_ring);
+	if (state->wlan_tx_ring)
+		munmap(state->tx_ring->map, state->tx_ring->map_len);
+	free(state->tx_ring);
+	if (state->wlan_tx_socket)
+		close(state->wlan_tx_fd);
+#endif /* __APPLE__ */
 	pcap_close(state->wlan_handle);
 }
 
 int wlan_send(const struct io_state *state, const uint8_t *buf, int len) {
+	struct iovec frame = { (void *) buf, len };
+	int err = wlan_send_batch(state, &frame, 1);
+	return err < 0 ? err : 0;
+}
+
+int wlan_txtime_usable(struct io_state *state) {
+#ifdef SO_TXTIME
+	int dropped;
+
+	if (!state || !state->wlan_txtime)
+		return 0;
+	dropped = tx_socket_txtime_errors(state->wlan_tx_fd);
+	if (dropped) {
+		log_warn("tx: kernel dropped %d frames at their launch time, sending immediately from now on", dropped);
+		state->wlan_txtime = 0;
+	}
+	return state->wlan_txtime;
+#else
+	(void) state;
+	return 0;
+#endif /* SO_TXTIME */
+}
+
+int wlan_send_at(struct io_state *state, const uint8_t *buf, int len, uint64_t at) {
+#ifdef SO_TXTIME
+	struct iovec frame = { (void *) buf, len };
 	int err;
-	if (!state || !state->wlan_handle)
-		return -EINVAL;
-	err = pcap_inject(state->wlan_handle, buf, len);
+
+	if (!state || !state->wlan_txtime)
+		return -ENOTSUP;
+	err = tx_socket_send_at(state->wlan_tx_fd, &frame, at);
 	if (err < 0) {
-		log_error("unable to inject packet (%s)", pcap_geterr(state->wlan_handle));
+		log_warn("tx: unable to send with launch time, sending immediately from now on (%s)", strerror(-err));
+		state->wlan_txtime = 0;
 		return err;
 	}
 	return 0;
+#else
+	(void) state;
+	(void) buf;
+	(void) len;
+	(void) at;
+	return -ENOTSUP;
+#endif /* SO_TXTIME */
+}
+
+int wlan_send_batch(const struct io_state *state, const struct iovec *frames, int num) {
+	int err;
+	if (!state || !state->wlan_handle || num > WLAN_SEND_BATCH_MAX)
+		return -EINVAL;
+#ifndef __APPLE__
+	if (state->wlan_tx_ring)
+		return tx_ring_send(state->tx_ring, state->wlan_tx_fd, frames, num);
+	if (state->wlan_tx_socket)
+		return tx_socket_send(state->wlan_tx_fd, frames, num);
+#endif /* __APPLE__ */
+	for (int i = 0; i < num; i++) {
+		err = pcap_inject(state->wlan_handle, frames[i].iov_base, frames[i].iov_len);
+		if (err < 0) {
+			log_error("unable to inject packet (%s)", pcap_geterr(state->wlan_handle));
+			return i ? i : err;
+		}
+	}
+	return num;
+}
+
+int wlan_recv(struct io_state *state, int cnt, pcap_handler cb, uint8_t *user) {
+	if (!state || !state->wlan_handle)
+		return -EINVAL;
+#ifndef __APPLE__
+	if (state->wlan_rx_ring)
+		return rx_ring_dispatch(&state->rx_ring, cnt, cb, user);
+#endif /* __APPLE__ */
+	return pcap_dispatch(state->wlan_handle, cnt, cb, user);
+}
+
+uint64_t wlan_rx_time(const struct io_state *state, const struct pcap_pkthdr *hdr, uint64_t now) {
+	struct timespec real;
+	int64_t captured, age;
+
+	/* capture timestamps are wall clock time, measure their age and apply it to our monotonic clock */
+	if (state->wlan_is_file || clock_gettime(CLOCK_REALTIME, &real))
+		return now;
+	captured = (int64_t) hdr->ts.tv_sec * 1000000000 + hdr->ts.tv_usec * (state->wlan_tstamp_nano ? 1 : 1000);
+	age = (int64_t) real.tv_sec * 1000000000 + real.tv_nsec - captured;
+	if (age < 0 || age > WLAN_RX_TIME_MAX_AGE_NS)
+		return now; /* wall clock has been adjusted */
+	return now - age / 1000;
 }
 
 int host_send(const struct io_state *state, const uint8_t *buf, int len) {
@@ -379,6 +917,15 @@ int host_send(const struct io_state *state, const uint8_t *buf, int len) {
 	return 0;
 }
 
+int host_send_iov(const struct io_state *state, const struct iovec *iov, int iovcnt) {
+	if (!state || !state->host_fd)
+		return -EINVAL;
+	if (writev(state->host_fd, iov, iovcnt) < 0) {
+		return -errno;
+	}
+	return 0;
+}
+
 int host_recv(const struct io_state *state, uint8_t *buf, int *len) {
 	long nread;
 	if (!state || !state->host_fd)
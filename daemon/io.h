@@ -24,6 +24,7 @@
 #include <pcap/pcap.h>
 #include <net/if.h>
 #include <limits.h>
+#include <sys/uio.h>
 
 #ifdef __APPLE__
 #include <net/ethernet.h>
@@ -31,6 +32,30 @@
 #include <netinet/ether.h>
 #endif
 
+/* Memory-mapped TPACKET_V3 receive ring (Linux only) */
+struct rx_ring {
+	int fd;
+	uint8_t *map;
+	size_t map_len;
+	unsigned int block_size;
+	unsigned int block_nr;
+	unsigned int block; /* block we are currently reading from */
+	unsigned int pkts_left; /* frames left in current block */
+	const uint8_t *pkt; /* next frame in current block, NULL if block was not yet opened */
+};
+
+/* Memory-mapped TPACKET_V2 transmit ring (Linux only) */
+struct tx_ring {
+	uint8_t *map;
+	size_t map_len;
+	unsigned int frame_size;
+	unsigned int frame_nr;
+	unsigned int frame; /* next frame to fill */
+};
+
+/* Maximum number of frames handed to the kernel in a single call */
+#define WLAN_SEND_BATCH_MAX 64
+
 struct io_state {
 	pcap_t *wlan_handle;
 	char wlan_ifname[PATH_MAX]; /* name of WLAN iface */
@@ -43,6 +68,14 @@ struct io_state {
 	char *dumpfile;
 	char wlan_no_monitor_mode;
 	int wlan_is_file;
+	int wlan_tstamp_nano; /* capture timestamps have nanosecond precision */
+	int wlan_rx_ring; /* receive via memory-mapped ring instead of libpcap if available */
+	struct rx_ring rx_ring;
+	int wlan_tx_socket; /* inject via packet socket instead of libpcap if available */
+	int wlan_tx_ring; /* use memory-mapped ring on that socket */
+	int wlan_tx_fd;
+	struct tx_ring *tx_ring; /* kept out of line so that sending does not modify the io_state */
+	int wlan_txtime; /* let the kernel release frames at their launch time (SO_TXTIME), see wlan_send_at() */
 };
 
 int io_state_init(struct io_state *state, const char *wlan, const char *host, const struct ether_addr *bssid_filter);
@@ -51,8 +84,64 @@ void io_state_free(struct io_state *state);
 
 int wlan_send(const struct io_state *state, const uint8_t *buf, int len);
 
+/**
+ * Whether frames can be queued with launch times, see wlan_send_at().
+ *
+ * SO_TXTIME is only enabled if an ETF qdisc is attached to the interface. Launch times
+ * are turned off for good once the kernel reports a frame it dropped instead of sending it.
+ */
+int wlan_txtime_usable(struct io_state *state);
+
+/**
+ * Queue a frame that should go on air at {@code at}, or right away if {@code at} has passed already.
+ *
+ * Does not send the frame if launch times are not usable, or if queueing it fails, which also
+ * turns them off for good. The caller then has to send it with wlan_send() instead.
+ *
+ * @param at launch time on our monotonic clock in us (see clock_time_us())
+ * @return 0 on success or a negative value on error
+ */
+int wlan_send_at(struct io_state *state, const uint8_t *buf, int len, uint64_t at);
+
+/**
+ * Inject up to {@code WLAN_SEND_BATCH_MAX} frames.
+ *
+ * Hands all frames to the kernel with a single call if the packet socket
+ * is set up, injects them one by one via libpcap otherwise.
+ *
+ * Frames that cannot be sent (e.g., because they are too large) are skipped.
+ *
+ * @return the number of frames sent or a negative value on error
+ */
+int wlan_send_batch(const struct io_state *state, const struct iovec *frames, int num);
+
+/**
+ * Receive up to {@code cnt} frames from the WLAN device and pass them to {@code cb}.
+ *
+ * Uses the RX ring if set up, libpcap otherwise.
+ *
+ * @return the number of frames processed or a negative value on error
+ */
+int wlan_recv(struct io_state *state, int cnt, pcap_handler cb, uint8_t *user);
+
+/* Capture timestamps older than this are not trusted */
+#define WLAN_RX_TIME_MAX_AGE_NS 1000000000
+
+/**
+ * Reception time of a frame on our monotonic clock (see clock_time_us()).
+ *
+ * Based on the capture timestamp so that queueing in the kernel and libpcap
+ * does not count as sync error.
+ *
+ * @param now the current time, returned if the capture timestamp is unusable
+ * @return reception time in us
+ */
+uint64_t wlan_rx_time(const struct io_state *state, const struct pcap_pkthdr *hdr, uint64_t now);
+
 int host_send(const struct io_state *state, const uint8_t *buf, int len);
 
+int host_send_iov(const struct io_state *state, const struct iovec *iov, int iovcnt);
+
 int host_recv(const struct io_state *state, uint8_t *buf, int *len);
 
 #endif /* OWL_IO_H */
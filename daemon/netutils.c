@@ -33,6 +33,7 @@
 #include <netlink/genl/ctrl.h>
 #include <netlink/route/link.h>
 #include <netlink/route/neighbour.h>
+#include <netlink/route/qdisc.h>
 #include <netlink/errno.h>
 
 #include <linux/nl80211.h>
@@ -99,6 +100,28 @@ static void nl80211_free(struct nl80211_state *state) {
 	nl_socket_free(state->socket);
 }
 
+/* Socket subscribed to nl80211 regulatory notifications */
+struct reg_events_state {
+	struct nl_sock *socket;
+	struct nl_cb *cb;
+};
+
+static struct reg_events_state reg_events_state;
+
+static void reg_events_free(struct reg_events_state *state);
+
+/* Separate socket so that acks can be received from the event loop without blocking */
+struct chan_switch_nl_state {
+	struct nl80211_state nl;
+	struct nl_cb *cb;
+	set_channel_cb done;
+	void *done_arg;
+};
+
+static struct chan_switch_nl_state chan_switch_nl_state;
+
+static void set_channel_async_free(struct chan_switch_nl_state *state);
+
 int netutils_init() {
 	int err;
 	err = nlroute_init(&nlroute_state);
@@ -111,6 +134,8 @@ int netutils_init() {
 }
 
 void netutils_cleanup() {
+	set_channel_async_free(&chan_switch_nl_state);
+	reg_events_free(&reg_events_state);
 	nlroute_free(&nlroute_state);
 	nl80211_free(&nl80211_state);
 }
@@ -254,26 +279,31 @@ out:
 
 #define BIT(x) (1ULL<<(x))
 
-struct channels_ctx {
-	int last_band;
-	bool width_40;
-	bool width_80;
-	bool width_160;
+#define WIPHY_FREQ_MAX 256
+#define WIPHY_BAND_MAX 8
+
+struct wiphy_freq {
+	uint32_t freq; /* in MHz */
+	uint8_t disabled : 1;
+	uint8_t no_ir : 1;
+	uint8_t ht40plus : 1; /* band supports 40 MHz and the channel above is usable as secondary channel */
 };
 
-struct channel_args {
-	int freq;
-	bool is_available;
-	struct channels_ctx ctx;
+/* Capabilities of the wiphy, dumped once and then only refreshed on regulatory changes */
+struct wiphy_cache {
+	int ifindex; /* 0 if cache is empty */
+	int num_freqs;
+	struct wiphy_freq freqs[WIPHY_FREQ_MAX];
+	bool band_ht40[WIPHY_BAND_MAX];
+	int last_band; /* for parsing split dumps */
 };
 
+static struct wiphy_cache wiphy_cache;
+
 /* Inspired by iw/phy.c */
-static int parse_freq_support(struct nl_msg *msg, void *arg)
-{
+static int parse_wiphy(struct nl_msg *msg, void *arg) {
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
-	struct channel_args *cargs = (struct channel_args *)arg;
-	int test_freq = cargs->freq;
-	struct channels_ctx *ctx = &cargs->ctx;
+	struct wiphy_cache *cache = (struct wiphy_cache *) arg;
 	struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
 	struct nlattr *tb_band[NL80211_BAND_ATTR_MAX + 1];
 	struct nlattr *tb_freq[NL80211_FREQUENCY_ATTR_MAX + 1];
@@ -283,68 +313,61 @@ static int parse_freq_support(struct nl_msg *msg, void *arg)
 
 	nla_parse(tb_msg, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
 
-	if (tb_msg[NL80211_ATTR_WIPHY_BANDS]) {
-		nla_for_each_nested(nl_band, tb_msg[NL80211_ATTR_WIPHY_BANDS], rem_band) {
-			if (ctx->last_band != nl_band->nla_type) {
-				ctx->width_40 = false;
-				ctx->width_80 = false;
-				ctx->width_160 = false;
-				ctx->last_band = nl_band->nla_type;
-			}
+	if (!tb_msg[NL80211_ATTR_WIPHY_BANDS])
+		return NL_SKIP;
 
-			nla_parse(tb_band, NL80211_BAND_ATTR_MAX, nla_data(nl_band), nla_len(nl_band), NULL);
+	nla_for_each_nested(nl_band, tb_msg[NL80211_ATTR_WIPHY_BANDS], rem_band) {
+		int band = nl_band->nla_type;
+		if (band >= WIPHY_BAND_MAX)
+			continue;
+		if (cache->last_band != band) {
+			cache->band_ht40[band] = false;
+			cache->last_band = band;
+		}
 
-			if (tb_band[NL80211_BAND_ATTR_FREQS]) {
-				nla_for_each_nested(nl_freq, tb_band[NL80211_BAND_ATTR_FREQS], rem_freq) {
-					uint32_t freq;
+		nla_parse(tb_band, NL80211_BAND_ATTR_MAX, nla_data(nl_band), nla_len(nl_band), NULL);
 
-					nla_parse(tb_freq, NL80211_FREQUENCY_ATTR_MAX, nla_data(nl_freq), nla_len(nl_freq), NULL);
+		/* capabilities precede the frequencies of a band in split dumps */
+		if (tb_band[NL80211_BAND_ATTR_HT_CAPA] &&
+		    (nla_get_u16(tb_band[NL80211_BAND_ATTR_HT_CAPA]) & BIT(1) /* supported channel width set */))
+			cache->band_ht40[band] = true;
 
-					if (!tb_freq[NL80211_FREQUENCY_ATTR_FREQ])
-						continue;
-					freq = nla_get_u32(tb_freq[NL80211_FREQUENCY_ATTR_FREQ]);
+		if (!tb_band[NL80211_BAND_ATTR_FREQS])
+			continue;
 
-					if ((int) freq != test_freq)
-						continue;
+		nla_for_each_nested(nl_freq, tb_band[NL80211_BAND_ATTR_FREQS], rem_freq) {
+			struct wiphy_freq *f;
 
-					if (tb_freq[NL80211_FREQUENCY_ATTR_DISABLED] || tb_freq[NL80211_FREQUENCY_ATTR_NO_IR]) {
-						if (tb_freq[NL80211_FREQUENCY_ATTR_DISABLED])
-							log_debug("Channel %d [%d MHz] is disabled", ieee80211_frequency_to_channel(freq), freq);
-						if (tb_freq[NL80211_FREQUENCY_ATTR_NO_IR])
-							log_debug("Channel %d [%d MHz] does not allow to initiate radiation first (no IR)", ieee80211_frequency_to_channel(freq), freq);
-						log_warn("Cannot inject frames on channel %d [%d MHz], try setting a regulatory domain (`iw reg set <CC>`) or using a different channel (6, 49, or 149)", ieee80211_frequency_to_channel(freq), freq);
-						continue;
-					}
+			nla_parse(tb_freq, NL80211_FREQUENCY_ATTR_MAX, nla_data(nl_freq), nla_len(nl_freq), NULL);
 
-					log_debug("Channel %d [%d MHz] is available for frame injection", ieee80211_frequency_to_channel(freq), freq);
-					cargs->is_available = true;
-				}
+			if (!tb_freq[NL80211_FREQUENCY_ATTR_FREQ])
+				continue;
+			if (cache->num_freqs == WIPHY_FREQ_MAX) {
+				log_warn("Too many frequencies, ignoring the rest");
+				return NL_SKIP;
 			}
+
+			f = &cache->freqs[cache->num_freqs++];
+			f->freq = nla_get_u32(tb_freq[NL80211_FREQUENCY_ATTR_FREQ]);
+			f->disabled = !!tb_freq[NL80211_FREQUENCY_ATTR_DISABLED];
+			f->no_ir = !!tb_freq[NL80211_FREQUENCY_ATTR_NO_IR];
+			f->ht40plus = cache->band_ht40[band] && !tb_freq[NL80211_FREQUENCY_ATTR_NO_HT40_PLUS];
 		}
 	}
 
 	return NL_SKIP;
 }
 
-int is_channel_available(int ifindex, const int channel, bool *is_available) {
+int wiphy_cache_refresh(int ifindex) {
 	int err;
-	struct nl_msg *m;
-	struct nl_cb *cb;
-	int freq;
-	static struct channel_args args = {
-		.is_available = false,
-		.ctx = {
-			.last_band = -1,
-		},
-	};
-	
-	freq = ieee80211_channel_to_frequency(channel);
-	if (!freq) {
-		log_error("Invalid channel number %d", channel);
-		err = -EINVAL;
-		goto out;
-	}
-	args.freq = freq;
+	struct nl_msg *m = NULL;
+	struct nl_cb *cb = NULL;
+	struct wiphy_cache fresh; /* the current cache stays in use if the dump fails */
+
+	fresh.ifindex = 0;
+	fresh.num_freqs = 0;
+	fresh.last_band = -1;
+	memset(fresh.band_ht40, 0, sizeof(fresh.band_ht40));
 
 	m = nlmsg_alloc();
 	if (!m) {
@@ -354,6 +377,11 @@ int is_channel_available(int ifindex, const int channel, bool *is_available) {
 	}
 
 	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!cb) {
+		log_error("Could not allocate netlink callback");
+		err = -ENOMEM;
+		goto out;
+	}
 
 	if (genlmsg_put(m, 0, 0, nl80211_state.nl80211_id, 0, 0, NL80211_CMD_GET_WIPHY, 0) == NULL) {
 		err = -ENOBUFS;
@@ -371,9 +399,17 @@ int is_channel_available(int ifindex, const int channel, bool *is_available) {
 		goto out;
 	}
 
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, parse_freq_support, &args);
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, parse_wiphy, &fresh);
 
 	err = nl_recvmsgs(nl80211_state.socket, cb);
+	if (err < 0) {
+		log_error("Error while receiving via netlink: %s", nl_geterror(err));
+		goto out;
+	}
+
+	fresh.ifindex = ifindex;
+	wiphy_cache = fresh;
+	log_debug("Cached %d frequencies of wiphy", wiphy_cache.num_freqs);
 	goto out;
 
 nla_put_failure:
@@ -384,38 +420,186 @@ out:
 		nl_cb_put(cb);
 	if (m)
 		nlmsg_free(m);
-	*is_available = args.is_available;
 	return err;
 }
 
-int set_channel(int ifindex, int channel) {
-	int err;
+/* Cached capabilities of {@code channel}, NULL if unknown or cache is empty */
+static const struct wiphy_freq *wiphy_cache_get(int ifindex, int channel) {
+	int freq = ieee80211_channel_to_frequency(channel);
+	if (!freq || wiphy_cache.ifindex != ifindex)
+		return NULL;
+	for (int i = 0; i < wiphy_cache.num_freqs; i++) {
+		if ((int) wiphy_cache.freqs[i].freq == freq)
+			return &wiphy_cache.freqs[i];
+	}
+	return NULL;
+}
+
+int is_channel_available(int ifindex, const int channel, bool *is_available) {
+	const struct wiphy_freq *f;
+	int freq;
+
+	*is_available = false;
+
+	freq = ieee80211_channel_to_frequency(channel);
+	if (!freq) {
+		log_error("Invalid channel number %d", channel);
+		return -EINVAL;
+	}
+
+	/* never dump here, we are called on the channel switch path */
+	if (wiphy_cache.ifindex != ifindex)
+		return -ENODATA;
+
+	f = wiphy_cache_get(ifindex, channel);
+	if (!f) {
+		log_debug("Channel %d [%d MHz] is not supported", channel, freq);
+		return 0;
+	}
+
+	if (f->disabled || f->no_ir) {
+		if (f->disabled)
+			log_debug("Channel %d [%d MHz] is disabled", channel, freq);
+		if (f->no_ir)
+			log_debug("Channel %d [%d MHz] does not allow to initiate radiation first (no IR)", channel, freq);
+		return 0;
+	}
+
+	if (!f->ht40plus) {
+		log_debug("Channel %d [%d MHz] does not support HT40+", channel, freq);
+		return 0;
+	}
+
+	*is_available = true;
+	return 0;
+}
+
+/* Accept every sequence number, events are not replies to our requests */
+static int seq_check_noop(struct nl_msg *msg, void *arg) {
+	(void) msg;
+	(void) arg;
+	return NL_OK;
+}
+
+static int parse_reg_event(struct nl_msg *msg, void *arg) {
+	(void) arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+
+	switch (gnlh->cmd) {
+		case NL80211_CMD_REG_CHANGE:
+		case NL80211_CMD_WIPHY_REG_CHANGE:
+			if (wiphy_cache.ifindex) {
+				log_info("Regulatory domain changed, refreshing channel capabilities");
+				wiphy_cache_refresh(wiphy_cache.ifindex);
+			}
+			break;
+		default:
+			break;
+	}
+	return NL_SKIP;
+}
+
+int reg_events_init() {
+	int err, group;
+	struct reg_events_state *state = &reg_events_state;
+
+	state->socket = nl_socket_alloc();
+	if (!state->socket) {
+		log_error("Failed to allocate netlink socket.");
+		return -ENOMEM;
+	}
+
+	if (genl_connect(state->socket)) {
+		log_error("Failed to connect to generic netlink.");
+		err = -ENOLINK;
+		goto fail;
+	}
+
+	group = genl_ctrl_resolve_grp(state->socket, "nl80211", "regulatory");
+	if (group < 0) {
+		log_warn("nl80211 regulatory events not supported");
+		err = group;
+		goto fail;
+	}
+
+	err = nl_socket_add_membership(state->socket, group);
+	if (err < 0) {
+		log_error("Could not join regulatory group: %s", nl_geterror(err));
+		goto fail;
+	}
+
+	state->cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!state->cb) {
+		err = -ENOMEM;
+		goto fail;
+	}
+	nl_cb_set(state->cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check_noop, NULL); /* events are unsolicited */
+	nl_cb_set(state->cb, NL_CB_VALID, NL_CB_CUSTOM, parse_reg_event, NULL);
+	nl_socket_set_nonblocking(state->socket);
+
+	return nl_socket_get_fd(state->socket);
+
+fail:
+	nl_socket_free(state->socket);
+	state->socket = NULL;
+	return err;
+}
+
+void reg_events_process() {
+	if (!reg_events_state.socket)
+		return;
+	nl_recvmsgs(reg_events_state.socket, reg_events_state.cb);
+}
+
+static void reg_events_free(struct reg_events_state *state) {
+	if (state->cb)
+		nl_cb_put(state->cb);
+	if (state->socket)
+		nl_socket_free(state->socket);
+	state->cb = NULL;
+	state->socket = NULL;
+}
+
+static int set_channel_msg(struct nl_msg **msg, int ifindex, int channel, int nl80211_id) {
 	struct nl_msg *m;
 	int freq;
 
 	freq = ieee80211_channel_to_frequency(channel);
 	if (!freq) {
 		log_error("Invalid channel number %d", channel);
-		err = -EINVAL;
-		goto out;
+		return -EINVAL;
 	}
 
 	m = nlmsg_alloc();
 	if (!m) {
 		log_error("Could not allocate netlink message");
-		err = -ENOMEM;
-		goto out;
+		return -ENOMEM;
 	}
 
-	if (genlmsg_put(m, 0, 0, nl80211_state.nl80211_id, 0, 0, NL80211_CMD_SET_CHANNEL, 0) == NULL) {
-		err = -ENOBUFS;
-		goto out;
-	}
+	if (genlmsg_put(m, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_CHANNEL, 0) == NULL)
+		goto nla_put_failure;
 
 	NLA_PUT_U32(m, NL80211_ATTR_IFINDEX, ifindex);
 	NLA_PUT_U32(m, NL80211_ATTR_WIPHY_FREQ, freq);
 	NLA_PUT_U32(m, NL80211_ATTR_WIPHY_CHANNEL_TYPE, NL80211_CHAN_HT40PLUS);
 
+	*msg = m;
+	return 0;
+
+nla_put_failure:
+	log_error("building message failed");
+	nlmsg_free(m);
+	return -ENOBUFS;
+}
+
+int set_channel(int ifindex, int channel) {
+	int err;
+	struct nl_msg *m = NULL;
+
+	err = set_channel_msg(&m, ifindex, channel, nl80211_state.nl80211_id);
+	if (err < 0)
+		goto out;
+
 	err = nl_send_auto(nl80211_state.socket, m);
 	if (err < 0) {
 		log_error("error while sending via netlink");
@@ -423,17 +607,94 @@ int set_channel(int ifindex, int channel) {
 	}
 
 	err = nl_recvmsgs_default(nl80211_state.socket);
-	goto out;
 
-nla_put_failure:
-	log_error("building message failed");
-	err = -ENOBUFS;
 out:
 	if (m)
 		nlmsg_free(m);
 	return err;
 }
 
+static int set_channel_ack(struct nl_msg *msg, void *arg) {
+	struct chan_switch_nl_state *state = arg;
+	if (state->done)
+		state->done(nlmsg_hdr(msg)->nlmsg_seq, 0, state->done_arg);
+	return NL_OK;
+}
+
+static int set_channel_error(struct sockaddr_nl *nla, struct nlmsgerr *nlerr, void *arg) {
+	(void) nla;
+	struct chan_switch_nl_state *state = arg;
+	if (state->done)
+		state->done(nlerr->msg.nlmsg_seq, nlerr->error, state->done_arg);
+	return NL_SKIP;
+}
+
+int set_channel_async_init() {
+	int err;
+	struct chan_switch_nl_state *state = &chan_switch_nl_state;
+
+	err = nl80211_init(&state->nl);
+	if (err < 0)
+		return err;
+
+	state->cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!state->cb) {
+		nl80211_free(&state->nl);
+		state->nl.socket = NULL;
+		return -ENOMEM;
+	}
+	/* several requests may be in flight, the set_channel_cb matches replies by sequence number */
+	nl_cb_set(state->cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check_noop, NULL);
+	nl_cb_set(state->cb, NL_CB_ACK, NL_CB_CUSTOM, set_channel_ack, state);
+	nl_cb_err(state->cb, NL_CB_CUSTOM, set_channel_error, state);
+	nl_socket_set_nonblocking(state->nl.socket);
+
+	return nl_socket_get_fd(state->nl.socket);
+}
+
+int set_channel_async(int ifindex, int channel, uint32_t *seq) {
+	int err;
+	struct nl_msg *m = NULL;
+	struct chan_switch_nl_state *state = &chan_switch_nl_state;
+
+	if (!state->nl.socket)
+		return -ENOTCONN;
+
+	err = set_channel_msg(&m, ifindex, channel, state->nl.nl80211_id);
+	if (err < 0)
+		return err;
+
+	err = nl_send_auto(state->nl.socket, m);
+	if (err < 0) {
+		log_error("error while sending via netlink: %s", nl_geterror(err));
+		goto out;
+	}
+	*seq = nlmsg_hdr(m)->nlmsg_seq;
+	err = 0;
+
+out:
+	nlmsg_free(m);
+	return err;
+}
+
+void set_channel_async_process(set_channel_cb done, void *arg) {
+	struct chan_switch_nl_state *state = &chan_switch_nl_state;
+	if (!state->nl.socket)
+		return;
+	state->done = done;
+	state->done_arg = arg;
+	nl_recvmsgs(state->nl.socket, state->cb);
+}
+
+static void set_channel_async_free(struct chan_switch_nl_state *state) {
+	if (state->cb)
+		nl_cb_put(state->cb);
+	if (state->nl.socket)
+		nl80211_free(&state->nl);
+	state->cb = NULL;
+	state->nl.socket = NULL;
+}
+
 static int link_updown(int ifindex, int up) {
 	int err;
 	struct rtnl_link *old, *req;
@@ -484,6 +745,26 @@ int link_ether_addr_get(const char *ifname, struct ether_addr *addr) {
 	return 0;
 }
 
+int link_has_qdisc(int ifindex, const char *kind) {
+	int err, found = 0;
+	struct nl_cache *cache;
+	struct nl_object *obj;
+
+	err = rtnl_qdisc_alloc_cache(nlroute_state.socket, &cache);
+	if (err < 0) {
+		log_error("Could not get qdiscs: %s", nl_geterror(err));
+		return err;
+	}
+
+	for (obj = nl_cache_get_first(cache); obj && !found; obj = nl_cache_get_next(obj)) {
+		const char *qdisc_kind = rtnl_tc_get_kind(TC_CAST(obj));
+		found = rtnl_tc_get_ifindex(TC_CAST(obj)) == ifindex && qdisc_kind && !strcmp(qdisc_kind, kind);
+	}
+
+	nl_cache_free(cache);
+	return found;
+}
+
 int get_hostname(char *name, size_t len) {
 	if (gethostname(name, len) < 0)
 		return -errno;
@@ -515,6 +796,11 @@ int set_monitor_mode(int ifindex) {
 	return 0;
 }
 
+int wiphy_cache_refresh(int ifindex) {
+	(void) ifindex;
+	return 0;
+}
+
 int is_channel_available(int ifindex, int channel, bool *is_available) {
 	/* we assume that channel is always available on macOS */
 	(void) ifindex;
@@ -523,10 +809,33 @@ int is_channel_available(int ifindex, int channel, bool *is_available) {
 	return 0;
 }
 
+int reg_events_init() {
+	return -ENOTSUP;
+}
+
+void reg_events_process() {
+}
+
 int set_channel(int ifindex, int channel) {
 	return corewlan_set_channel(ifindex, channel);
 }
 
+int set_channel_async_init() {
+	return -ENOTSUP;
+}
+
+int set_channel_async(int ifindex, int channel, uint32_t *seq) {
+	(void) ifindex;
+	(void) channel;
+	(void) seq;
+	return -ENOTSUP;
+}
+
+void set_channel_async_process(set_channel_cb done, void *arg) {
+	(void) done;
+	(void) arg;
+}
+
 int link_up(int ifindex) {
 	(void) ifindex;
 	return 0; /* TODO implement */
@@ -551,6 +860,12 @@ int link_ether_addr_get(const char *ifname, struct ether_addr *addr) {
 	return -1;
 }
 
+int link_has_qdisc(int ifindex, const char *kind) {
+	(void) ifindex;
+	(void) kind;
+	return -ENOTSUP;
+}
+
 int get_hostname(char *name, size_t len) {
 	return corewlan_get_hostname(name, len);
 }
@@ -21,6 +21,7 @@
 #define OWL_NETUTILS_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <netinet/in.h>
 #ifdef __APPLE__
 #include <net/ethernet.h>
@@ -44,16 +45,61 @@ void netutils_cleanup();
 
 int set_monitor_mode(int ifindex);
 
+/**
+ * Dump and cache the channel capabilities of the wiphy that {@code ifindex} belongs to.
+ *
+ * Called once at startup and again on regulatory changes (see reg_events_process()).
+ *
+ * @return 0 on success, a negative value on failure
+ */
+int wiphy_cache_refresh(int ifindex);
+
+/*
+ * Check against cached capabilities whether we can inject frames on {@code channel} with the HT40+ channel type
+ * that set_channel() requests, -ENODATA if cache is empty
+ */
 int is_channel_available(int ifindex, int channel, bool *is_available);
 
+/**
+ * Subscribe to regulatory change notifications.
+ * @return file descriptor to watch for events, or a negative value on failure
+ */
+int reg_events_init();
+
+/* Handle pending notifications, refreshes the wiphy cache if the regulatory domain changed */
+void reg_events_process();
+
+/* Switch channel and wait for the kernel to acknowledge */
 int set_channel(int ifindex, int channel);
 
+/* Called for every acknowledged (err == 0) or failed channel switch request */
+typedef void (*set_channel_cb)(uint32_t seq, int err, void *arg);
+
+/**
+ * Open a non-blocking nl80211 socket for set_channel_async().
+ * @return file descriptor to watch for acks, or a negative value on failure
+ */
+int set_channel_async_init();
+
+/**
+ * Request a channel switch without waiting for the kernel.
+ * @param seq is set to the sequence number that will be passed to the {@code set_channel_cb}
+ * @return 0 if the request was sent, a negative value on failure
+ */
+int set_channel_async(int ifindex, int channel, uint32_t *seq);
+
+/* Handle pending acks, call from the event loop when the socket becomes readable */
+void set_channel_async_process(set_channel_cb done, void *arg);
+
 int link_up(int ifindex);
 
 int link_down(int ifindex);
 
 int link_ether_addr_get(const char *ifname, struct ether_addr *addr);
 
+/* Whether a qdisc of type {@code kind} (e.g., "etf") is attached to {@code ifindex}, negative on error */
+int link_has_qdisc(int ifindex, const char *kind);
+
 int get_hostname(char *name, size_t len);
 
 int neighbor_add(int ifindex, const struct ether_addr *, const struct in6_addr *);
@@ -31,6 +31,28 @@
 #define DEFAULT_AWDL_DEVICE "awdl0"
 #define FAILED_DUMP "failed.pcap"
 
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s -i <interface> [options]\n", name);
+	fprintf(stderr, "  -i <iface>  WLAN interface (or pcap file) to use\n"
+	                "  -h <iface>  name of the host interface (default: " DEFAULT_AWDL_DEVICE ")\n"
+	                "  -c <chan>   AWDL channel: 6, 44, or 149 (default: 6)\n"
+	                "  -D          run as daemon\n"
+	                "  -d          dump unhandled frames to " FAILED_DUMP "\n"
+	                "  -v          increase log level, can be repeated\n"
+	                "  -f          do not filter peers by RSSI\n"
+	                "  -N          do not put the interface into monitor mode\n"
+	                "  -b <num>    frames to receive per wakeup at most (default: 64)\n"
+	                "  -B <us>     time to spend receiving per wakeup at most (default: 2000)\n"
+	                "  -R          receive via a memory-mapped ring (Linux only)\n"
+	                "  -A <len>    maximum A-MSDU length, 0 disables aggregation (default: 2304, max: 7935)\n"
+	                "  -P <num>    maximum number of peers, 0 for no limit (default: 256)\n"
+	                "  -F <num>    frames from an unknown address before it becomes a peer (default: 2)\n"
+	                "  -S          inject via a packet socket (Linux only)\n"
+	                "  -T          inject via a memory-mapped ring on the packet socket, implies -S\n"
+	                "  -L <us>     queue action frames with launch times (SO_TXTIME) this much ahead, implies -S,\n"
+	                "              needs an ETF qdisc, 0 for the default (1000, max: 16384)\n");
+}
+
 static void daemonize() {
 	pid_t pid;
 	long x;
@@ -91,6 +113,15 @@ int main(int argc, char *argv[]) {
 	int log_level = LOG_INFO;
 	int filter_rssi = 1;
 	int no_monitor_mode = 0;
+	int rx_ring = 0;
+	int tx_socket = 0;
+	int tx_ring = 0;
+	int rx_batch_frames = 0;
+	long rx_batch_usec = -1;
+	int amsdu_max_len = -1;
+	int max_peers = -1;
+	int admit_frames = -1;
+	long txtime_lead = -1;
 
 	char wlan[PATH_MAX] = "";
 	char host[IFNAMSIZ] = DEFAULT_AWDL_DEVICE;
@@ -99,7 +130,7 @@ int main(int argc, char *argv[]) {
 
 	struct daemon_state state;
 
-	while ((c = getopt(argc, argv, "Dc:dvi:h:a:t:fN")) != -1) {
+	while ((c = getopt(argc, argv, "Dc:dvi:h:a:t:fNb:B:RA:STP:F:L:")) != -1) {
 		switch (c) {
 			case 'D':
 				daemon = 1;
@@ -126,9 +157,37 @@ int main(int argc, char *argv[]) {
 			case 'N':
 				no_monitor_mode = 1;
 				break;
+			case 'R':
+				rx_ring = 1;
+				break;
+			case 'S':
+				tx_socket = 1;
+				break;
+			case 'T':
+				tx_ring = 1;
+				break;
+			case 'b':
+				rx_batch_frames = atoi(optarg);
+				break;
+			case 'B':
+				rx_batch_usec = atol(optarg);
+				break;
+			case 'A':
+				amsdu_max_len = atoi(optarg);
+				break;
+			case 'P':
+				max_peers = atoi(optarg);
+				break;
+			case 'F':
+				admit_frames = atoi(optarg);
+				break;
+			case 'L':
+				txtime_lead = atol(optarg);
+				break;
 			case '?':
 				if (optopt == 'i')
 					fprintf(stderr, "Option -%c needs to specify a wireless interface.\n", optopt);
+				usage(argv[0]);
 				return EXIT_FAILURE;
 			default:
 				abort();
@@ -183,16 +242,33 @@ int main(int argc, char *argv[]) {
 
 	if (!*wlan) {
 		log_error("No interface specified");
+		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 
 	state.io.wlan_no_monitor_mode = no_monitor_mode;
+	state.io.wlan_rx_ring = rx_ring;
+	state.io.wlan_tx_socket = tx_socket;
+	state.io.wlan_tx_ring = tx_ring;
+	state.io.wlan_txtime = txtime_lead >= 0;
 
 	if (awdl_init(&state, wlan, host, chan, dump ? FAILED_DUMP : 0) < 0) {
 		log_error("could not initialize core");
 		return EXIT_FAILURE;
 	}
 	state.awdl_state.filter_rssi = filter_rssi;
+	if (rx_batch_frames > 0)
+		state.rx_batch_frames = rx_batch_frames;
+	if (rx_batch_usec >= 0)
+		state.rx_batch_usec = rx_batch_usec;
+	if (amsdu_max_len >= 0)
+		state.amsdu_max_len = amsdu_max_len < AWDL_AMSDU_MAX_LEN ? amsdu_max_len : AWDL_AMSDU_MAX_LEN;
+	if (max_peers >= 0)
+		state.awdl_state.peers.max_peers = max_peers;
+	if (admit_frames > 0)
+		state.awdl_state.peers.admit_frames = admit_frames;
+	if (txtime_lead > 0)
+		state.txtime_lead = txtime_lead < TXTIME_LEAD_MAX ? txtime_lead : TXTIME_LEAD_MAX;
 
 	if (state.io.wlan_ifindex)
 		log_info("WLAN device: %s (addr %s)", state.io.wlan_ifname, ether_ntoa(&state.io.if_ether_addr));
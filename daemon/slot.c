@@ -0,0 +1,156 @@
+/*
+ * OWL: an open Apple Wireless Direct Link (AWDL) implementation
+ * Copyright (C) 2018  The Open Wireless Link Project
+ * Copyright (C) 2018  Milan Stute
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef __APPLE__
+#include <sys/timerfd.h>
+#endif
+
+#include "slot.h"
+#include "state.h"
+#include "schedule.h"
+#include "ieee80211.h"
+#include "log.h"
+
+static void slot_engine_program(struct slot_engine *engine) {
+	uint64_t next = slot_engine_next(engine, ~0u);
+
+	if (next == UINT64_MAX)
+		next = 0;
+	if (next == engine->armed)
+		return;
+	engine->armed = next;
+
+#ifndef __APPLE__
+	if (engine->fd >= 0) {
+		struct itimerspec spec;
+		memset(&spec, 0, sizeof(spec));
+		if (next) {
+			spec.it_value.tv_sec = next / 1000000;
+			spec.it_value.tv_nsec = (next % 1000000) * 1000;
+		}
+		if (timerfd_settime(engine->fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+			log_error("timerfd_settime: %s", strerror(errno));
+		return;
+	}
+#endif
+
+	ev_timer_stop(engine->loop, &engine->timer);
+	if (next) {
+		uint64_t now = clock_time_us();
+		ev_timer_set(&engine->timer, next > now ? usec_to_sec(next - now) : 0., 0.);
+		ev_timer_start(engine->loop, &engine->timer);
+	}
+}
+
+static void slot_engine_wakeup(struct slot_engine *engine) {
+	uint64_t now = clock_time_us();
+
+	if (engine->armed) {
+		uint64_t late = now > engine->armed ? now - engine->armed : 0;
+		engine->stats.wakeups++;
+		engine->stats.late_total += late;
+		if (late > engine->stats.late_max)
+			engine->stats.late_max = late;
+		if (late >= ieee80211_tu_to_usec(1))
+			engine->stats.late_tu++;
+	}
+	engine->armed = 0;
+
+	engine->dispatching = true;
+	engine->cb(engine, now, engine->cb_data);
+	engine->dispatching = false;
+
+	slot_engine_program(engine);
+}
+
+#ifndef __APPLE__
+static void slot_engine_fd_ready(struct ev_loop *loop, ev_io *handle, int revents) {
+	(void) loop;
+	(void) revents; /* should always be EV_READ */
+	struct slot_engine *engine = handle->data;
+	uint64_t expirations;
+
+	if (read(engine->fd, &expirations, sizeof(expirations)) < 0)
+		return; /* spurious wakeup, e.g., timer was reprogrammed */
+	slot_engine_wakeup(engine);
+}
+#endif
+
+static void slot_engine_timer(struct ev_loop *loop, ev_timer *handle, int revents) {
+	(void) loop;
+	(void) revents; /* should always be EV_TIMER */
+	slot_engine_wakeup(handle->data);
+}
+
+void slot_engine_init(struct slot_engine *engine, struct ev_loop *loop, slot_dispatch_cb cb, void *data) {
+	memset(engine, 0, sizeof(*engine));
+	engine->loop = loop;
+	engine->cb = cb;
+	engine->cb_data = data;
+	engine->fd = -1;
+
+	engine->timer.data = (void *) engine;
+	ev_timer_init(&engine->timer, slot_engine_timer, 0, 0);
+
+#ifndef __APPLE__
+	engine->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (engine->fd < 0) {
+		log_warn("timerfd_create: %s, falling back to ev_timer", strerror(errno));
+		return;
+	}
+	engine->fd_watcher.data = (void *) engine;
+	ev_io_init(&engine->fd_watcher, slot_engine_fd_ready, engine->fd, EV_READ);
+	ev_io_start(loop, &engine->fd_watcher);
+#endif
+}
+
+void slot_engine_free(struct slot_engine *engine) {
+	if (!engine->loop)
+		return;
+	ev_timer_stop(engine->loop, &engine->timer);
+	if (engine->fd >= 0) {
+		ev_io_stop(engine->loop, &engine->fd_watcher);
+		close(engine->fd);
+		engine->fd = -1;
+	}
+}
+
+void slot_engine_arm(struct slot_engine *engine, enum slot_event event, uint64_t at) {
+	engine->deadline[event] = at;
+	if (!engine->dispatching) /* otherwise, reprogrammed once the dispatch completes */
+		slot_engine_program(engine);
+}
+
+bool slot_engine_due(const struct slot_engine *engine, enum slot_event event, uint64_t now) {
+	return engine->deadline[event] && engine->deadline[event] <= now;
+}
+
+uint64_t slot_engine_next(const struct slot_engine *engine, unsigned int mask) {
+	uint64_t next = UINT64_MAX;
+	for (int i = 0; i < SLOT_EVENT_MAX; i++) {
+		if (!(mask & SLOT_EVENT_MASK(i)) || !engine->deadline[i])
+			continue;
+		if (engine->deadline[i] < next)
+			next = engine->deadline[i];
+	}
+	return next;
+}
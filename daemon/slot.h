@@ -0,0 +1,88 @@
+/*
+ * OWL: an open Apple Wireless Direct Link (AWDL) implementation
+ * Copyright (C) 2018  The Open Wireless Link Project
+ * Copyright (C) 2018  Milan Stute
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OWL_SLOT_H
+#define OWL_SLOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <ev.h>
+
+/* Events driven by the slot engine, dispatched in this order if due at the same time */
+enum slot_event {
+	SLOT_EVENT_CHAN = 0,
+	SLOT_EVENT_PSF,
+	SLOT_EVENT_MIF,
+	SLOT_EVENT_TX_UNICAST,
+	SLOT_EVENT_TX_MULTICAST,
+	SLOT_EVENT_MAX,
+};
+
+#define SLOT_EVENT_MASK(event) (1u << (event))
+
+struct slot_stats {
+	uint64_t wakeups;
+	uint64_t late_total; /* in us */
+	uint64_t late_max; /* in us */
+	uint64_t late_tu; /* wakeups that were late by at least one TU */
+};
+
+struct slot_engine;
+
+/* Called on every wakeup, should run all events for which slot_engine_due() is true */
+typedef void (*slot_dispatch_cb)(struct slot_engine *engine, uint64_t now, void *data);
+
+struct slot_engine {
+	struct ev_loop *loop;
+	uint64_t deadline[SLOT_EVENT_MAX]; /* absolute CLOCK_MONOTONIC time in us, 0 if not armed */
+	uint64_t armed; /* deadline the timer is currently programmed for, 0 if none */
+	bool dispatching;
+	int fd; /* timerfd, -1 if we fall back to ev_timer */
+	ev_io fd_watcher;
+	ev_timer timer;
+	slot_dispatch_cb cb;
+	void *cb_data;
+	struct slot_stats stats;
+};
+
+/**
+ * Set up a slot engine which uses a timerfd with absolute deadlines if available
+ * @param engine the engine
+ * @param loop event loop to register with
+ * @param cb dispatch function
+ * @param data passed to {@code cb}
+ */
+void slot_engine_init(struct slot_engine *engine, struct ev_loop *loop, slot_dispatch_cb cb, void *data);
+
+void slot_engine_free(struct slot_engine *engine);
+
+/**
+ * Schedule an event
+ * @param engine the engine
+ * @param event the event
+ * @param at absolute time in us, 0 cancels the event
+ */
+void slot_engine_arm(struct slot_engine *engine, enum slot_event event, uint64_t at);
+
+bool slot_engine_due(const struct slot_engine *engine, enum slot_event event, uint64_t now);
+
+/* Earliest deadline (in us) of the events in {@code mask}, UINT64_MAX if none is armed */
+uint64_t slot_engine_next(const struct slot_engine *engine, unsigned int mask);
+
+#endif /* OWL_SLOT_H */
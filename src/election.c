@@ -64,46 +64,44 @@ static int awdl_election_compare_master(const struct awdl_election_state *a, con
 	return result;
 }
 
-void awdl_election_run(struct awdl_election_state *state, const struct awdl_peer_state *peers) {
-	struct awdl_peer *peer;
-	struct ether_addr old_top_master = state->master_addr;
-	struct ether_addr old_sync_master = state->sync_addr;
-	struct awdl_election_state *master_state = state;
-	awdl_peers_it_t it = awdl_peers_it_new(peers->peers);
-
-	awdl_election_reset_self(state);
+/* Positive if {@code a} is the better sync master: higher top master metric, then lower height, then higher address */
+static int awdl_election_compare_candidate(const struct awdl_election_state *a, const struct awdl_election_state *b) {
+	int result = awdl_election_compare_master(a, b);
+	if (!result)
+		result = compare(b->height, a->height);
+	if (!result)
+		result = compare_ether_addr(&a->self_addr, &b->self_addr);
+	return result;
+}
 
-	/* probably not fully correct */
-	while (awdl_peers_it_next(it, &peer) == PEERS_OK) {
-		int cmp_metric;
-		struct awdl_election_state *peer_state = &peer->election;
-		if (!peer->is_valid)
-			continue; /* reject: not a valid peer */
-		if (peer_state->height + 1 > AWDL_ELECTION_TREE_MAX_HEIGHT) {
-			log_debug("Ignore peer %s because sync tree would get too large (%u, max %u)",
-			          ether_ntoa(&peer_state->self_addr), peer_state->height + 1, AWDL_ELECTION_TREE_MAX_HEIGHT);
-			continue; /* reject: tree would get too large if accepted as sync master */
-		}
-		if (awdl_election_is_sync_master(peer_state, &state->self_addr))
-			continue; /* reject: do not allow cycles in sync tree */
-		cmp_metric = awdl_election_compare_master(peer_state, master_state);
-		if (cmp_metric < 0) {
-			continue; /* reject: lower top master metric */
-		} else if (cmp_metric == 0) {
-			/* if metric is same, compare distance to master */
-			if (peer_state->height > master_state->height) {
-				continue; /* reject: do not increase length of sync tree */
-			} else if (peer_state->height == master_state->height) {
-				/* if height is same, need tie breaker */
-				if (compare_ether_addr(&peer_state->self_addr, &master_state->self_addr) <= 0)
-					continue; /* reject: peer has smaller address */
-			}
-		}
-		/* accept: otherwise */
-		master_state = peer_state;
+static int awdl_election_is_eligible(const struct awdl_election_state *state, const struct awdl_peer *peer) {
+	const struct awdl_election_state *peer_state = &peer->election;
+	if (!peer->is_valid)
+		return 0; /* reject: not a valid peer */
+	if (peer_state->height + 1 > AWDL_ELECTION_TREE_MAX_HEIGHT) {
+		log_debug("Ignore peer %s because sync tree would get too large (%u, max %u)",
+		          ether_ntoa(&peer_state->self_addr), peer_state->height + 1, AWDL_ELECTION_TREE_MAX_HEIGHT);
+		return 0; /* reject: tree would get too large if accepted as sync master */
 	}
+	if (awdl_election_is_sync_master(peer_state, &state->self_addr))
+		return 0; /* reject: do not allow cycles in sync tree */
+	return 1;
+}
+
+/* The sync master we currently follow, as far as needed by awdl_election_compare_candidate() */
+static void awdl_election_current(const struct awdl_election_state *state, struct awdl_election_state *current) {
+	*current = *state;
+	current->self_addr = state->sync_addr;
+	current->height = state->height ? state->height - 1 : 0;
+}
+
+static void awdl_election_adopt(struct awdl_election_state *state, const struct awdl_election_state *master_state) {
+	struct ether_addr old_top_master = state->master_addr;
+	struct ether_addr old_sync_master = state->sync_addr;
 
-	if (state != master_state) { /* adopt new master */
+	if (state == master_state) {
+		awdl_election_reset_self(state);
+	} else { /* adopt new master */
 		state->master_addr = master_state->master_addr;
 		state->sync_addr = master_state->self_addr;
 		state->master_metric = master_state->master_metric;
@@ -119,6 +117,59 @@ void awdl_election_run(struct awdl_election_state *state, const struct awdl_peer
 	}
 }
 
+void awdl_election_run(struct awdl_election_state *state, const struct awdl_peer_state *peers) {
+	struct awdl_peer *peer;
+	struct awdl_election_state self;
+	const struct awdl_election_state *master_state;
+	struct awdl_peers_it it;
+
+	/* compare against ourselves as top master */
+	self = *state;
+	awdl_election_reset_self(&self);
+	master_state = &self;
+
+	/* probably not fully correct */
+	awdl_peers_it_init(&it, peers->peers);
+	while (awdl_peers_it_next(&it, &peer) == PEERS_OK) {
+		if (!awdl_election_is_eligible(state, peer))
+			continue;
+		if (awdl_election_compare_candidate(&peer->election, master_state) <= 0)
+			continue; /* reject: not better than current candidate */
+		/* accept: otherwise */
+		master_state = &peer->election;
+	}
+
+	awdl_election_adopt(state, master_state == &self ? state : master_state);
+}
+
+void awdl_election_update(struct awdl_election_state *state, const struct awdl_peer_state *peers,
+                          const struct awdl_peer *peer) {
+	struct awdl_election_state current;
+	int is_sync_master = compare_ether_addr(&state->sync_addr, &state->self_addr) &&
+	                     awdl_election_is_sync_master(state, &peer->addr);
+
+	awdl_election_current(state, &current);
+	if (is_sync_master) {
+		/* keep following our sync master as long as it did not get worse, otherwise look for a new one */
+		if (awdl_election_is_eligible(state, peer) && awdl_election_compare_candidate(&peer->election, &current) >= 0)
+			awdl_election_adopt(state, &peer->election);
+		else
+			awdl_election_run(state, peers);
+	} else if (awdl_election_is_eligible(state, peer) &&
+	           awdl_election_compare_candidate(&peer->election, &current) > 0) {
+		awdl_election_adopt(state, &peer->election);
+	}
+}
+
+void awdl_election_check(struct awdl_election_state *state, const struct awdl_peer_state *peers) {
+	struct awdl_peer *peer;
+
+	if (!compare_ether_addr(&state->sync_addr, &state->self_addr))
+		return; /* we are the top master */
+	if (awdl_peer_get(peers->peers, &state->sync_addr, &peer) != PEERS_OK || !peer->is_valid)
+		awdl_election_run(state, peers); /* sync master is gone */
+}
+
 int awdl_election_tree_print(const struct awdl_election_state *state, char *str, int len) {
 	char *cur = str, *const end = str + len;
 	cur += snprintf(cur, cur < end ? end - cur: 0, "%s", ether_ntoa(&state->self_addr));
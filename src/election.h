@@ -43,8 +43,21 @@ int awdl_election_is_sync_master(const struct awdl_election_state *state, const
 
 void awdl_election_state_init(struct awdl_election_state *state, const struct ether_addr *self);
 
+struct awdl_peer;
+
+/* Full election over all peers, also needed after changing our own metric or counter */
 void awdl_election_run(struct awdl_election_state *state, const struct awdl_peer_state *peers);
 
+/**
+ * Incremental election after the election parameters of a single peer have changed or the peer has turned valid.
+ * Only falls back to awdl_election_run() if our current sync master got worse.
+ */
+void awdl_election_update(struct awdl_election_state *state, const struct awdl_peer_state *peers,
+                          const struct awdl_peer *peer);
+
+/* Run the election again if our sync master has been removed from the peer table */
+void awdl_election_check(struct awdl_election_state *state, const struct awdl_peer_state *peers);
+
 int awdl_election_tree_print(const struct awdl_election_state *state, char *str, int len);
 
 /* Util functions */
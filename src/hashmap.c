@@ -1,50 +1,91 @@
 /*
  * Generic map implementation.
+ *
+ * Open addressing with Robin Hood probing: on insertion, an element that is
+ * closer to its home bucket than the one being inserted gives up its place.
+ * This keeps probe lengths short and uniform, and lets lookups stop as soon
+ * as they meet an element closer to home than the key would be. Deletion
+ * shifts the rest of the cluster back by one bucket, so no tombstones are
+ * needed and probe chains never break.
  */
 #include "hashmap.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "siphash24.h"
 
 #define INITIAL_SIZE (256)
-#define MAX_CHAIN_LENGTH (8)
+/* Grow when more than 7/8 of the buckets are in use */
+#define GROW_LOAD_NUM (7)
+#define GROW_LOAD_DEN (8)
+/* Shrink when less than 1/8 of the buckets are in use */
+#define SHRINK_LOAD_DEN (8)
+/* Probe length that triggers an early resize ... */
+#define MAX_PROBE_LENGTH (32)
+/* ... but only if the table is at least 1/MAX_PROBE_LOAD_DEN full, to avoid rehash storms */
+#define MAX_PROBE_LOAD_DEN (2)
 
 /* We need to keep keys and values */
 typedef struct _hashmap_element{
 	mkey_t key;
-	int in_use;
 	any_t data;
+	uint32_t hash;
+	uint32_t dist; /* distance from home bucket plus one, zero if bucket is empty */
 } hashmap_element;
 
 /* A hashmap has some maximum size and current size,
  * as well as the data to hold. */
 typedef struct _hashmap_map{
-	int table_size;
+	unsigned int table_size; /* always a power of two */
+	unsigned int mask;
 	int size;
 	int key_size; /* size of user's mkey_t in bytes */
 	hashmap_element *data;
 	unsigned char seed[siphash24_KEYBYTES];
 } hashmap_map;
 
+static unsigned char hashmap_seed[siphash24_KEYBYTES];
+static int hashmap_seed_valid;
+
+static void hashmap_seed_init() {
+	FILE *f;
+	if (hashmap_seed_valid)
+		return;
+	f = fopen("/dev/urandom", "r");
+	if (f) {
+		hashmap_seed_valid = fread(hashmap_seed, sizeof(hashmap_seed), 1, f) == 1;
+		fclose(f);
+	}
+	if (!hashmap_seed_valid) {
+		uint64_t fallback[2];
+		fallback[0] = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+		fallback[1] = (uint64_t) (uintptr_t) &fallback ^ (uint64_t) clock();
+		memcpy(hashmap_seed, fallback, sizeof(hashmap_seed));
+		hashmap_seed_valid = 1;
+	}
+}
+
 /*
  * Return an empty hashmap, or NULL on failure.
  */
 map_t hashmap_new(int key_size) {
-	hashmap_map* m = (hashmap_map*) malloc(sizeof(hashmap_map));
+	hashmap_map* m = (hashmap_map*) calloc(1, sizeof(hashmap_map));
 	if(!m) goto err;
 
 	m->data = (hashmap_element*) calloc(INITIAL_SIZE, sizeof(hashmap_element));
 	if(!m->data) goto err;
 
 	m->table_size = INITIAL_SIZE;
+	m->mask = INITIAL_SIZE - 1;
 	m->size = 0;
 	m->key_size = key_size;
 
-	/* TODO init seed randomly */
-	memset(m->seed, 0, siphash24_KEYBYTES);
+	hashmap_seed_init();
+	memcpy(m->seed, hashmap_seed, siphash24_KEYBYTES);
 
 	return m;
 err:
@@ -54,82 +95,101 @@ err:
 }
 
 /*
- * Hashing function for a string
+ * Hashing function for an arbitrary key
  */
-unsigned int hashmap_hash_int(hashmap_map *m, mkey_t key) {
+static uint32_t hashmap_hash_int(const hashmap_map *m, mkey_t key) {
 	uint64_t hash;
 	siphash24((unsigned char *) &hash, key, m->key_size, m->seed);
-	return hash % m->table_size;
+	return (uint32_t) hash;
 }
 
 /*
- * Return the integer of the location in data
- * to store the point to the item, or MAP_FULL.
+ * Return the index of the element with {@code key}, or MAP_MISSING.
  */
-int hashmap_hash(map_t in, mkey_t key){
-	int curr;
-	int i;
-
-	/* Cast the hashmap */
-	hashmap_map* m = (hashmap_map *) in;
-
-	/* If full, return immediately */
-	if(m->size >= (m->table_size/2)) return MAP_FULL;
-
-	/* Find the best index */
-	curr = hashmap_hash_int(m, key);
+static int hashmap_find(const hashmap_map *m, mkey_t key, uint32_t hash) {
+	unsigned int curr = hash & m->mask;
+	uint32_t dist;
 
-	/* Linear probing */
-	for(i = 0; i< MAX_CHAIN_LENGTH; i++){
-		if(m->data[curr].in_use == 0)
+	for (dist = 1; dist <= m->data[curr].dist; dist++) {
+		const hashmap_element *e = &m->data[curr];
+		if (e->hash == hash && memcmp(e->key, key, m->key_size) == 0)
 			return curr;
+		curr = (curr + 1) & m->mask;
+	}
 
-		if (m->data[curr].in_use == 1 && (memcmp(m->data[curr].key, key, m->key_size) == 0))
-			return curr;
+	/* Reached an empty bucket or one that is closer to home than we would be */
+	return MAP_MISSING;
+}
 
-		curr = (curr + 1) % m->table_size;
+/*
+ * Insert an element that is known not to be in the map yet.
+ * Returns the probe length of the inserted element.
+ */
+static uint32_t hashmap_insert(hashmap_map *m, hashmap_element e) {
+	unsigned int curr = e.hash & m->mask;
+	uint32_t max_dist = 0;
+
+	for (e.dist = 1;; e.dist++) {
+		hashmap_element *slot = &m->data[curr];
+		if (!slot->dist) {
+			*slot = e;
+			break;
+		}
+		if (slot->dist < e.dist) {
+			/* Take from the rich: evict the element closer to its home bucket */
+			hashmap_element tmp = *slot;
+			*slot = e;
+			e = tmp;
+		}
+		if (e.dist > max_dist)
+			max_dist = e.dist;
+		curr = (curr + 1) & m->mask;
 	}
+	if (e.dist > max_dist)
+		max_dist = e.dist;
 
-	return MAP_FULL;
+	m->size++;
+	return max_dist;
 }
 
 /*
- * Doubles the size of the hashmap, and rehashes all the elements
+ * Remove the element at {@code curr} and shift the rest of its cluster back.
  */
-enum map_status hashmap_rehash(map_t in){
-	int i;
-	int old_size;
-	hashmap_element* curr;
+static void hashmap_erase(hashmap_map *m, unsigned int curr) {
+	unsigned int next = (curr + 1) & m->mask;
+
+	while (m->data[next].dist > 1) {
+		m->data[curr] = m->data[next];
+		m->data[curr].dist--;
+		curr = next;
+		next = (next + 1) & m->mask;
+	}
+	memset(&m->data[curr], 0, sizeof(hashmap_element));
 
-	/* Setup the new elements */
-	hashmap_map *m = (hashmap_map *) in;
-	hashmap_element* temp = (hashmap_element *)
-		calloc(2 * m->table_size, sizeof(hashmap_element));
-	if(!temp) return MAP_OMEM;
+	m->size--;
+}
 
-	/* Update the array */
-	curr = m->data;
-	m->data = temp;
+/*
+ * Reallocates the hashmap with {@code table_size} buckets and reinserts all elements
+ */
+static enum map_status hashmap_resize(hashmap_map *m, unsigned int table_size) {
+	unsigned int i;
+	unsigned int old_size = m->table_size;
+	hashmap_element *old = m->data;
+	hashmap_element *temp = (hashmap_element *) calloc(table_size, sizeof(hashmap_element));
+	if (!temp)
+		return MAP_OMEM;
 
-	/* Update the size */
-	old_size = m->table_size;
-	m->table_size = 2 * m->table_size;
+	m->data = temp;
+	m->table_size = table_size;
+	m->mask = table_size - 1;
 	m->size = 0;
 
-	/* Rehash the elements */
-	for(i = 0; i < old_size; i++){
-		int status;
-
-		if (curr[i].in_use == 0)
-			continue;
-
-		status = hashmap_put(m, curr[i].key, curr[i].data);
-		if (status != MAP_OK)
-			return status;
-	}
-
-	free(curr);
+	for (i = 0; i < old_size; i++)
+		if (old[i].dist)
+			hashmap_insert(m, old[i]);
 
+	free(old);
 	return MAP_OK;
 }
 
@@ -137,26 +197,34 @@ enum map_status hashmap_rehash(map_t in){
  * Add a pointer to the hashmap with some key
  */
 enum map_status hashmap_put(map_t in, mkey_t key, any_t value){
+	hashmap_map *m = (hashmap_map *) in;
+	hashmap_element e;
+	uint32_t dist;
 	int index;
-	hashmap_map* m;
 
-	/* Cast the hashmap */
-	m = (hashmap_map *) in;
+	e.hash = hashmap_hash_int(m, key);
 
-	/* Find a place to put our value */
-	index = hashmap_hash(in, key);
-	while(index == MAP_FULL){
-		if (hashmap_rehash(in) == MAP_OMEM) {
+	/* Update existing element */
+	index = hashmap_find(m, key, e.hash);
+	if (index >= 0) {
+		m->data[index].key = key;
+		m->data[index].data = value;
+		return MAP_OK;
+	}
+
+	/* Make sure there is always at least one empty bucket left */
+	if ((unsigned int) (m->size + 1) * GROW_LOAD_DEN > m->table_size * GROW_LOAD_NUM) {
+		if (hashmap_resize(m, 2 * m->table_size) != MAP_OK)
 			return MAP_OMEM;
-		}
-		index = hashmap_hash(in, key);
 	}
 
-	/* Set the data */
-	m->data[index].data = value;
-	m->data[index].key = key;
-	m->data[index].in_use = 1;
-	m->size++;
+	e.key = key;
+	e.data = value;
+	dist = hashmap_insert(m, e);
+
+	/* Long probe sequences are unlikely with a random seed; only grow if the table is reasonably full */
+	if (dist > MAX_PROBE_LENGTH && (unsigned int) m->size * MAX_PROBE_LOAD_DEN >= m->table_size)
+		hashmap_resize(m, 2 * m->table_size); /* failing is fine, element is already in */
 
 	return MAP_OK;
 }
@@ -165,47 +233,27 @@ enum map_status hashmap_put(map_t in, mkey_t key, any_t value){
  * Get your pointer out of the hashmap with a key
  */
 enum map_status hashmap_get(map_t in, mkey_t key, any_t *arg, int remove) {
-	int curr;
-	int i;
-	hashmap_map* m;
-
-	/* Cast the hashmap */
-	m = (hashmap_map *) in;
-
-	/* Find data location */
-	curr = hashmap_hash_int(m, key);
-
-	/* Linear probing, if necessary */
-	for(i = 0; i<MAX_CHAIN_LENGTH; i++){
-
-		int in_use = m->data[curr].in_use;
-		if (in_use == 1){
-			if (memcmp(m->data[curr].key, key, m->key_size) == 0) {
-				if (arg)
-					*arg = (m->data[curr].data);
-
-				if (remove) {
-					/* Blank out the fields */
-					m->data[curr].in_use = 0;
-					m->data[curr].data = NULL;
-					m->data[curr].key = NULL;
-
-					/* Reduce the size */
-					m->size--;
-				}
-
-				return MAP_OK;
-			}
-		}
+	hashmap_map *m = (hashmap_map *) in;
+	int index = hashmap_find(m, key, hashmap_hash_int(m, key));
 
-		curr = (curr + 1) % m->table_size;
+	if (index < 0) {
+		if (arg)
+			*arg = NULL;
+		/* Not found */
+		return MAP_MISSING;
 	}
 
 	if (arg)
-		*arg = NULL;
+		*arg = m->data[index].data;
 
-	/* Not found */
-	return MAP_MISSING;
+	if (remove) {
+		hashmap_erase(m, index);
+		/* Shrink on low load, never below the initial size */
+		if (m->table_size > INITIAL_SIZE && (unsigned int) m->size * SHRINK_LOAD_DEN < m->table_size)
+			hashmap_resize(m, m->table_size / 2); /* keep the larger table on failure */
+	}
+
+	return MAP_OK;
 }
 
 /* Deallocate the hashmap */
@@ -222,10 +270,28 @@ int hashmap_length(map_t in){
 	else return 0;
 }
 
-typedef struct _hashmap_it {
-	hashmap_map *map;
-	int i; /* current index */
-} hashmap_it;
+/**
+ * Initialize an iterator, e.g., one on the stack.
+ * @param it the iterator
+ * @param in the hashmap
+ */
+void hashmap_it_init(struct hashmap_it *it, map_t in) {
+	hashmap_map *m = (hashmap_map *) in;
+	unsigned int start = 0;
+
+	/*
+	 * Start right after an empty bucket: since clusters never span an empty bucket,
+	 * removing the current element only moves elements that have not been visited yet.
+	 * There is always an empty bucket, see hashmap_put().
+	 */
+	while (m->data[start].dist)
+		start++;
+
+	it->map = in;
+	it->start = start;
+	it->i = 0;
+	it->valid = 0;
+}
 
 /**
  * Get a new iterator.
@@ -233,31 +299,41 @@ typedef struct _hashmap_it {
  * @return a new iterator of hashmap
  */
 map_it_t hashmap_it_new(map_t in) {
-	hashmap_it *it = (hashmap_it *) malloc(sizeof(hashmap_it));
-	it->map = (hashmap_map *) in;
-	it->i = -1;
+	struct hashmap_it *it = (struct hashmap_it *) malloc(sizeof(struct hashmap_it));
+	if (!it)
+		return NULL;
+	hashmap_it_init(it, in);
 	return (map_it_t) it;
 }
 
 /**
- * Get next element in hashmap. You should not modify the the map while iterating.
+ * Get next element in hashmap. You should not modify the the map while iterating,
+ * except with hashmap_it_remove().
  * @param it hashmap iterator
  * @param key set to current element's key if return MAP_OK
  * @param value set to current element's value if return MAP_OK
  * @return MAP_OK if had next, MAP_MISSING otherwise
  */
 enum map_status hashmap_it_next(map_it_t _it, mkey_t *key, any_t *value) {
-	hashmap_it *it = (hashmap_it *) _it;
+	struct hashmap_it *it = (struct hashmap_it *) _it;
+	hashmap_map *m = (hashmap_map *) it->map;
 
-	/* Linear probing */
-	for (it->i++; it->i < it->map->table_size; it->i++)
-		if (it->map->data[it->i].in_use != 0) {
+	/* it->i counts buckets from start that are done, the current one is still pending after a remove */
+	if (it->valid)
+		it->i++;
+	it->valid = 0;
+
+	for (; it->i < m->table_size; it->i++) {
+		hashmap_element *e = &m->data[(it->start + it->i) & m->mask];
+		if (e->dist) {
 			if (key)
-				*key = it->map->data[it->i].key;
+				*key = e->key;
 			if (value)
-				*value = (any_t) (it->map->data[it->i].data);
+				*value = e->data;
+			it->valid = 1;
 			return MAP_OK;
 		}
+	}
 
 	return MAP_MISSING;
 }
@@ -268,22 +344,18 @@ enum map_status hashmap_it_next(map_it_t _it, mkey_t *key, any_t *value) {
  * @return MAP_OK if iterator points to valid element, MAP_MISSING otherwise
  */
 enum map_status hashmap_it_remove(map_it_t _it) {
-	hashmap_it *it = (hashmap_it *) _it;
+	struct hashmap_it *it = (struct hashmap_it *) _it;
+	hashmap_map *m = (hashmap_map *) it->map;
 
-	if (it->i < 0 || it->i >= it->map->table_size)
-		return MAP_MISSING;
-
-	if (!it->map->data[it->i].in_use)
+	if (!it->valid)
 		/* could be that we are calling remove on an already removed element */
 		return MAP_MISSING;
 
-	it->map->data[it->i].in_use = 0;
-	it->map->data[it->i].data = NULL;
-	it->map->data[it->i].key = NULL;
-
-	/* Reduce the size */
-	it->map->size--;
+	/* The next element may have been shifted into the current bucket, so visit it again */
+	hashmap_erase(m, (it->start + it->i) & m->mask);
+	it->valid = 0;
 
+	/* No shrinking here: resizing would invalidate the iterator */
 	return MAP_OK;
 }
 
@@ -292,6 +364,5 @@ enum map_status hashmap_it_remove(map_it_t _it) {
  * @param it hashmap iterator
  */
 void hashmap_it_free(map_it_t _it) {
-	hashmap_it *it = (hashmap_it *) _it;
-	free(it);
+	free(_it);
 }
@@ -44,7 +44,9 @@ typedef any_t map_t;
 extern map_t hashmap_new(int mkey_len);
 
 /*
- * Add an element to the hashmap. Return MAP_OK or MAP_OMEM.
+ * Add an element to the hashmap, replacing the value if the key exists.
+ * The key is not copied and must stay valid while it is in the map.
+ * Return MAP_OK or MAP_OMEM.
  */
 extern enum map_status hashmap_put(map_t in, mkey_t key, any_t value);
 
@@ -66,10 +68,28 @@ extern void hashmap_free(map_t in);
 extern int hashmap_length(map_t in);
 
 /**
- * Opaque iterator type
+ * Opaque iterator type, points to a struct hashmap_it
  */
 typedef any_t map_it_t;
 
+/**
+ * Iterator state, can be allocated on the stack and set up with hashmap_it_init().
+ * Its members are internal.
+ */
+struct hashmap_it {
+	map_t map;
+	unsigned int start;
+	unsigned int i;
+	int valid;
+};
+
+/**
+ * Initialize an iterator without allocating memory. Does not need to be freed.
+ * @param it the iterator
+ * @param in the hashmap
+ */
+extern void hashmap_it_init(struct hashmap_it *it, map_t in);
+
 /**
  * Get a new iterator.
  * @param in the hashmap
@@ -78,7 +98,8 @@ typedef any_t map_it_t;
 extern map_it_t hashmap_it_new(map_t in);
 
 /**
- * Get next element in hashmap. You should not modify the the map while iterating.
+ * Get next element in hashmap. You should not modify the the map while iterating,
+ * except with hashmap_it_remove().
  * @param it hashmap iterator
  * @param key set to current element's key if return MAP_OK
  * @param value set to current element's value if return MAP_OK
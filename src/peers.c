@@ -20,56 +20,303 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "peers.h"
-#include "hashmap.h"
+#include "state.h"
+#include "wire.h"
 #include "log.h"
 
 #define PEERS_DEFAULT_TIMEOUT        2000000 /* in ms */
 #define PEERS_DEFAULT_CLEAN_INTERVAL 1000000 /* in ms */
+#define PEERS_DEFAULT_MAX            256
+#define PEERS_DEFAULT_ADMIT_FRAMES   2 /* a single (e.g., spoofed) frame does not create a peer */
+#define PEERS_DEFAULT_ADMIT_BUDGET   32
+#define PEERS_DEFAULT_ADMIT_WINDOW   1000000 /* in us */
 
 void awdl_peer_state_init(struct awdl_peer_state *state) {
 	state->peers = awdl_peers_init();
 	state->timeout = PEERS_DEFAULT_TIMEOUT;
 	state->clean_interval = PEERS_DEFAULT_CLEAN_INTERVAL;
+	state->max_peers = PEERS_DEFAULT_MAX;
+	state->admit_frames = PEERS_DEFAULT_ADMIT_FRAMES;
+	state->admit_budget = PEERS_DEFAULT_ADMIT_BUDGET;
+	state->admit_window = PEERS_DEFAULT_ADMIT_WINDOW;
 }
 
-awdl_peers_t awdl_peers_init() {
-	return (awdl_peers_t) hashmap_new(sizeof(struct ether_addr));
-}
+/* Peers are stored in fixed-size chunks so that their addresses remain stable */
+#define PEERS_CHUNK_SIZE 32
+#define PEERS_INDEX_MIN_SIZE 64 /* power of two */
+
+#define PEERS_KEY_USED (1ULL << 48) /* distinguishes a used index slot from an empty one */
+
+/* Hashed timing wheel on last_update, must cover more than the peer timeout */
+#define PEERS_WHEEL_SHIFT 14 /* PEERS_EXPIRY_RESOLUTION */
+#define PEERS_WHEEL_SIZE 256 /* power of two, ~4.2 s */
+#define PEERS_WHEEL_MASK (PEERS_WHEEL_SIZE - 1)
 
-void awdl_peers_free(awdl_peers_t peers) {
+/* Unknown addresses waiting for admission, direct-mapped: a flood of addresses only overwrites candidates */
+#define PEERS_CANDIDATES 64 /* power of two */
+
+struct peers_chunk {
+	struct awdl_peer peers[PEERS_CHUNK_SIZE];
+	uint32_t used; /* bitmap */
+};
+
+struct peers_index_slot {
+	uint64_t key; /* MAC address in the lower 48 bits, 0 if empty */
 	struct awdl_peer *peer;
-	map_t map = (map_t) peers;
+};
+
+struct peers_candidate {
+	uint64_t key; /* 0 if unused */
+	uint64_t first_seen;
+	uint32_t frames;
+};
+
+struct awdl_peers {
+	/* open addressing with linear probing, at most half full */
+	struct peers_index_slot *index;
+	uint32_t index_mask;
+	uint32_t length;
+	struct peers_chunk **chunks;
+	uint32_t num_chunks;
+	/* most frames come in bursts from the same sender */
+	uint64_t last_key;
+	struct awdl_peer *last_peer; /* NULL if last_key is not in the index */
+	struct peers_index_slot *last_slot; /* where last_key would be inserted if last_peer is NULL */
+	/* peers are linked into bucket max(last_update >> PEERS_WHEEL_SHIFT, wheel_tick) */
+	struct awdl_peer *wheel[PEERS_WHEEL_SIZE];
+	uint64_t wheel_tick; /* first tick that has not been fully expired */
+	/* admission control */
+	struct peers_candidate candidates[PEERS_CANDIDATES];
+	uint64_t admit_window_start;
+	uint32_t admit_window_count;
+};
+
+static uint64_t peers_seed;
+
+static uint64_t peers_key(const struct ether_addr *addr) {
+	const uint8_t *a = addr->ether_addr_octet;
+	return PEERS_KEY_USED | ((uint64_t) a[0] << 40) | ((uint64_t) a[1] << 32) | ((uint64_t) a[2] << 24) |
+	       ((uint64_t) a[3] << 16) | ((uint64_t) a[4] << 8) | (uint64_t) a[5];
+}
+
+static uint32_t peers_hash(uint64_t key) {
+	/* not cryptographic, but the random seed makes it hard to predict collisions */
+	key ^= peers_seed;
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (uint32_t) key;
+}
+
+static void peers_seed_init() {
+	FILE *f;
+	if (peers_seed)
+		return;
+	f = fopen("/dev/urandom", "r");
+	if (f) {
+		if (fread(&peers_seed, sizeof(peers_seed), 1, f) != 1)
+			peers_seed = 0;
+		fclose(f);
+	}
+	if (!peers_seed)
+		peers_seed = clock_time_us() ^ ((uint64_t) getpid() << 32) ^ (uintptr_t) &peers_seed;
+}
+
+/* Returns the slot containing {@code key} or the empty slot where it would be inserted */
+static struct peers_index_slot *peers_index_find(const struct awdl_peers *peers, uint64_t key) {
+	uint32_t i = peers_hash(key) & peers->index_mask;
+	while (peers->index[i].key && peers->index[i].key != key)
+		i = (i + 1) & peers->index_mask;
+	return &peers->index[i];
+}
+
+static int peers_index_resize(struct awdl_peers *peers, uint32_t size) {
+	struct peers_index_slot *old = peers->index;
+	uint32_t old_size = peers->index_mask + 1;
+
+	peers->index = calloc(size, sizeof(struct peers_index_slot));
+	if (!peers->index) {
+		peers->index = old;
+		return -1;
+	}
+	peers->index_mask = size - 1;
+	peers->last_key = 0; /* last_slot points into the old index */
+	peers->last_peer = NULL;
+	for (uint32_t i = 0; i < old_size; i++) {
+		if (old[i].key)
+			*peers_index_find(peers, old[i].key) = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+/* Backward-shift deletion keeps probe sequences intact without tombstones */
+static void peers_index_delete(struct awdl_peers *peers, struct peers_index_slot *slot) {
+	uint32_t i = slot - peers->index;
+	uint32_t j = i;
+
+	for (;;) {
+		uint32_t home;
+		j = (j + 1) & peers->index_mask;
+		if (!peers->index[j].key)
+			break;
+		home = peers_hash(peers->index[j].key) & peers->index_mask;
+		/* move j to i unless its home lies cyclically in (i, j] */
+		if (((j - home) & peers->index_mask) >= ((j - i) & peers->index_mask)) {
+			peers->index[i] = peers->index[j];
+			i = j;
+		}
+	}
+	peers->index[i].key = 0;
+	peers->index[i].peer = NULL;
+}
+
+static struct awdl_peer *peers_slab_alloc(struct awdl_peers *peers) {
+	struct peers_chunk *chunk, **chunks;
+	int slot;
 
-	/* Remove all allocated peers */
-	map_it_t it = hashmap_it_new(map);
-	while (hashmap_it_next(it, NULL, (any_t *) &peer) == MAP_OK) {
-		hashmap_it_remove(it);
-		free(peer);
+	for (uint32_t c = 0; c < peers->num_chunks; c++) {
+		chunk = peers->chunks[c];
+		if (chunk->used == UINT32_MAX)
+			continue;
+		slot = __builtin_ctz(~chunk->used);
+		chunk->used |= 1u << slot;
+		return &chunk->peers[slot];
 	}
-	hashmap_it_free(it);
 
-	/* Remove hashmap itself */
-	hashmap_free(peers);
+	chunk = calloc(1, sizeof(struct peers_chunk));
+	if (!chunk)
+		return NULL;
+	chunks = realloc(peers->chunks, (peers->num_chunks + 1) * sizeof(struct peers_chunk *));
+	if (!chunks) {
+		free(chunk);
+		return NULL;
+	}
+	peers->chunks = chunks;
+	peers->chunks[peers->num_chunks++] = chunk;
+	chunk->used = 1;
+	return &chunk->peers[0];
+}
+
+static void peers_slab_free(struct awdl_peers *peers, struct awdl_peer *peer) {
+	for (uint32_t c = 0; c < peers->num_chunks; c++) {
+		struct peers_chunk *chunk = peers->chunks[c];
+		if (peer >= chunk->peers && peer < chunk->peers + PEERS_CHUNK_SIZE) {
+			chunk->used &= ~(1u << (peer - chunk->peers));
+			return;
+		}
+	}
+}
+
+static uint64_t peers_wheel_tick(const struct awdl_peers *peers, const struct awdl_peer *peer) {
+	uint64_t tick = peer->last_update >> PEERS_WHEEL_SHIFT;
+	return tick < peers->wheel_tick ? peers->wheel_tick : tick;
+}
+
+static void peers_wheel_link(struct awdl_peers *peers, struct awdl_peer *peer) {
+	struct awdl_peer **head;
+	peer->expiry_tick = peers_wheel_tick(peers, peer);
+	head = &peers->wheel[peer->expiry_tick & PEERS_WHEEL_MASK];
+	peer->expiry_next = *head;
+	if (*head)
+		(*head)->expiry_pprev = &peer->expiry_next;
+	peer->expiry_pprev = head;
+	*head = peer;
+}
+
+static void peers_wheel_unlink(struct awdl_peer *peer) {
+	*peer->expiry_pprev = peer->expiry_next;
+	if (peer->expiry_next)
+		peer->expiry_next->expiry_pprev = peer->expiry_pprev;
+	peer->expiry_next = NULL;
+	peer->expiry_pprev = NULL;
+}
+
+/* Move peer to the bucket matching its last_update, O(1) */
+static void peers_wheel_update(struct awdl_peers *peers, struct awdl_peer *peer) {
+	if (peers_wheel_tick(peers, peer) == peer->expiry_tick)
+		return;
+	peers_wheel_unlink(peer);
+	peers_wheel_link(peers, peer);
+}
+
+static void awdl_peer_release(struct awdl_peer *peer) {
+	if (peer->tx_queue) {
+		void *buf;
+		while (!circular_buf_get(peer->tx_queue, &buf, 0))
+			buf_free(buf);
+		circular_buf_free(peer->tx_queue);
+		peer->tx_queue = NULL;
+	}
+}
+
+/* Remove {@code peer} from index and slab, peer must not be accessed afterwards */
+static void awdl_peers_delete(struct awdl_peers *peers, struct awdl_peer *peer) {
+	uint64_t key = peers_key(&peer->addr);
+	struct peers_index_slot *slot = peers_index_find(peers, key);
+	if (slot->key)
+		peers_index_delete(peers, slot);
+	if (peers->last_key == key || !peers->last_peer) { /* shifting may have moved the insert position */
+		peers->last_key = 0;
+		peers->last_peer = NULL;
+	}
+	peers->length--;
+	peers_wheel_unlink(peer);
+	awdl_peer_release(peer);
+	peers_slab_free(peers, peer);
+}
+
+awdl_peers_t awdl_peers_init() {
+	struct awdl_peers *peers = calloc(1, sizeof(struct awdl_peers));
+	if (!peers)
+		return NULL;
+	peers_seed_init();
+	peers->index = calloc(PEERS_INDEX_MIN_SIZE, sizeof(struct peers_index_slot));
+	if (!peers->index) {
+		free(peers);
+		return NULL;
+	}
+	peers->index_mask = PEERS_INDEX_MIN_SIZE - 1;
+	return (awdl_peers_t) peers;
+}
+
+void awdl_peers_free(awdl_peers_t in) {
+	struct awdl_peers *peers = (struct awdl_peers *) in;
+
+	/* Release all allocated peers */
+	for (uint32_t c = 0; c < peers->num_chunks; c++) {
+		struct peers_chunk *chunk = peers->chunks[c];
+		for (int i = 0; i < PEERS_CHUNK_SIZE; i++) {
+			if (chunk->used & (1u << i))
+				awdl_peer_release(&chunk->peers[i]);
+		}
+		free(chunk);
+	}
+	free(peers->chunks);
+	free(peers->index);
+	free(peers);
 }
 
 int awdl_peers_length(awdl_peers_t peers) {
-	map_t map = (map_t) peers;
-	return hashmap_length(map);
+	return ((struct awdl_peers *) peers)->length;
 }
 
 static int awdl_peer_is_valid(const struct awdl_peer *peer) {
 	return peer->sent_mif && peer->devclass && peer->version;
 }
 
-struct awdl_peer *awdl_peer_new(const struct ether_addr *addr) {
-	struct awdl_peer *peer = (struct awdl_peer *) malloc(sizeof(struct awdl_peer));
+static void awdl_peer_init(struct awdl_peer *peer, const struct ether_addr *addr) {
 	*(struct ether_addr *) &peer->addr = *addr;
 	peer->last_update = 0;
 	awdl_election_state_init(&peer->election, addr);
 	awdl_chanseq_init_static(peer->sequence, &CHAN_NULL);
+	peer->overlap = 0;
+	memset(peer->next_overlap, AWDL_CHANSEQ_LENGTH, sizeof(peer->next_overlap));
 	peer->sync_offset = 0;
+	peer->sync_valid = 0;
 	peer->devclass = 0;
 	peer->version = 0;
 	peer->supports_v2 = 0;
@@ -77,67 +324,171 @@ struct awdl_peer *awdl_peer_new(const struct ether_addr *addr) {
 	strcpy(peer->name, "");
 	strcpy(peer->country_code, "NA");
 	peer->is_valid = 0;
-	return peer;
+	peer->data_hdr_len = 0;
+	peer->tx_queue = NULL;
 }
 
-enum peers_status
-awdl_peer_add(awdl_peers_t peers, const struct ether_addr *_addr, uint64_t now, awdl_peer_cb cb, void *arg) {
-	int status, result;
-	map_t map = (map_t) peers;
-	mkey_t addr = (mkey_t) _addr;
-	struct awdl_peer *peer;
-	status = hashmap_get(map, addr, (any_t *) &peer, 0 /* do not remove */);
-	if (status == MAP_MISSING)
-		peer = awdl_peer_new(_addr); /* create new entry */
+static struct awdl_peer *awdl_peers_lookup(struct awdl_peers *peers, uint64_t key) {
+	struct peers_index_slot *slot;
+	if (peers->last_key == key)
+		return peers->last_peer;
+	slot = peers_index_find(peers, key);
+	/* also remember misses, so that inserting an unknown sender right after does not probe again */
+	peers->last_key = key;
+	peers->last_peer = slot->key ? slot->peer : NULL;
+	peers->last_slot = slot;
+	return peers->last_peer;
+}
 
-	/* update */
-	peer->last_update = now;
+enum peers_status
+awdl_peer_upsert(awdl_peers_t in, const struct ether_addr *addr, uint64_t now, struct awdl_peer **peer) {
+	struct awdl_peers *peers = (struct awdl_peers *) in;
+	uint64_t key = peers_key(addr);
+	struct peers_index_slot *slot;
+	enum peers_status result = PEERS_UPDATE;
 
-	if (status == MAP_OK) {
-		result = PEERS_UPDATE;
-		goto out;
+	if (peers->last_key == key && peers->last_peer) {
+		*peer = peers->last_peer;
+		return PEERS_UPDATE;
 	}
 
-	status = hashmap_put(map, (mkey_t) &peer->addr, peer);
-	if (status != MAP_OK) {
-		free(peer);
+	if (2 * (peers->length + 1) > peers->index_mask + 1 &&
+	    peers_index_resize(peers, 2 * (peers->index_mask + 1)) < 0)
 		return PEERS_INTERNAL;
+
+	/* either the peer or where to insert it, known already if the last lookup was a miss */
+	slot = peers->last_key == key ? peers->last_slot : peers_index_find(peers, key);
+	if (!slot->key) {
+		slot->peer = peers_slab_alloc(peers);
+		if (!slot->peer)
+			return PEERS_INTERNAL;
+		slot->key = key;
+		awdl_peer_init(slot->peer, addr); /* create new entry */
+		slot->peer->last_update = now;
+		peers_wheel_link(peers, slot->peer);
+		peers->length++;
+		result = PEERS_OK;
 	}
-	result = PEERS_OK;
-out:
-	if (!peer->is_valid && awdl_peer_is_valid(peer)) {
-		/* peer has turned valid */
-		peer->is_valid = 1;
-		log_info("add peer %s (%s)", ether_ntoa(&peer->addr), peer->name);
-		if (cb)
-			cb(peer, arg);
+	peers->last_key = key;
+	peers->last_peer = slot->peer;
+	*peer = slot->peer;
+	return result;
+}
+
+/* Least recently updated peer, preferring peers that never turned valid */
+static struct awdl_peer *peers_wheel_lru(struct awdl_peers *peers) {
+	struct awdl_peer *lru[2] = { NULL, NULL }; /* indexed by is_valid */
+
+	/* buckets are visited from oldest to newest, peers within a bucket are unordered */
+	for (uint64_t tick = peers->wheel_tick; tick < peers->wheel_tick + PEERS_WHEEL_SIZE; tick++) {
+		for (struct awdl_peer *peer = peers->wheel[tick & PEERS_WHEEL_MASK]; peer; peer = peer->expiry_next) {
+			struct awdl_peer **cur = &lru[peer->is_valid];
+			if (!*cur || peer->last_update < (*cur)->last_update)
+				*cur = peer;
+		}
+		if (lru[0])
+			return lru[0];
 	}
+	return lru[1];
+}
+
+/* Returns whether {@code key} has been seen often enough to be admitted */
+static int peers_candidate_seen(struct awdl_peers *peers, uint64_t key, uint64_t now,
+                                const struct awdl_peer_state *state) {
+	struct peers_candidate *c = &peers->candidates[peers_hash(key) & (PEERS_CANDIDATES - 1)];
+
+	if (c->key != key || now - c->first_seen > state->timeout) {
+		c->key = key;
+		c->first_seen = now;
+		c->frames = 0;
+	}
+	if (++c->frames < state->admit_frames)
+		return 0;
+	c->key = 0;
+	return 1;
+}
+
+enum peers_status awdl_peer_admit(struct awdl_peer_state *state, const struct ether_addr *addr, uint64_t now,
+                                  struct awdl_peer **peer, awdl_peer_cb evict_cb, void *arg) {
+	struct awdl_peers *peers = (struct awdl_peers *) state->peers;
+	enum peers_status result;
+
+	if (state->admit_budget) {
+		if (now - peers->admit_window_start >= state->admit_window) {
+			peers->admit_window_start = now;
+			peers->admit_window_count = 0;
+		}
+		if (peers->admit_window_count >= state->admit_budget)
+			return PEERS_REJECTED;
+	}
+
+	if (!peers_candidate_seen(peers, peers_key(addr), now, state))
+		return PEERS_REJECTED;
+
+	while (state->max_peers && peers->length >= state->max_peers) {
+		struct awdl_peer *lru = peers_wheel_lru(peers);
+		if (!lru)
+			return PEERS_INTERNAL;
+		log_debug("evict peer %s (%s)", ether_ntoa(&lru->addr), lru->name);
+		if (evict_cb)
+			evict_cb(lru, arg);
+		awdl_peers_delete(peers, lru);
+	}
+
+	result = awdl_peer_upsert(state->peers, addr, now, peer);
+	if (result == PEERS_OK)
+		peers->admit_window_count++;
 	return result;
 }
 
-enum peers_status awdl_peer_remove(awdl_peers_t peers, const struct ether_addr *_addr, awdl_peer_cb cb, void *arg) {
-	int status;
-	map_t map = (map_t) peers;
-	mkey_t addr = (mkey_t) _addr;
+void awdl_peer_touch(awdl_peers_t peers, struct awdl_peer *peer, uint64_t now) {
+	peer->last_update = now;
+	peers_wheel_update((struct awdl_peers *) peers, peer);
+}
+
+enum peers_status
+awdl_peer_commit(awdl_peers_t peers, struct awdl_peer *peer, uint64_t now, awdl_peer_cb cb, void *arg) {
+	awdl_peer_touch(peers, peer, now);
+	if (peer->is_valid || !awdl_peer_is_valid(peer))
+		return PEERS_UPDATE;
+	/* peer has turned valid */
+	peer->is_valid = 1;
+	log_info("add peer %s (%s)", ether_ntoa(&peer->addr), peer->name);
+	if (cb)
+		cb(peer, arg);
+	return PEERS_VALID;
+}
+
+enum peers_status
+awdl_peer_add(awdl_peers_t peers, const struct ether_addr *addr, uint64_t now, awdl_peer_cb cb, void *arg) {
 	struct awdl_peer *peer;
-	status = hashmap_get(map, addr, (any_t *) &peer, 1 /* remove */);
-	if (status == MAP_MISSING)
+	enum peers_status result = awdl_peer_upsert(peers, addr, now, &peer);
+	if (result < 0)
+		return result;
+	awdl_peer_commit(peers, peer, now, cb, arg);
+	return result;
+}
+
+enum peers_status awdl_peer_remove(awdl_peers_t in, const struct ether_addr *addr, awdl_peer_cb cb, void *arg) {
+	struct awdl_peers *peers = (struct awdl_peers *) in;
+	struct awdl_peer *peer = awdl_peers_lookup(peers, peers_key(addr));
+	if (!peer)
 		return PEERS_MISSING;
 	if (peer->is_valid) {
 		log_info("remove peer %s (%s)", ether_ntoa(&peer->addr), peer->name);
 		if (cb)
 			cb(peer, arg);
 	}
-	free(peer);
+	awdl_peers_delete(peers, peer);
 	return PEERS_OK;
 }
 
-enum peers_status awdl_peer_get(awdl_peers_t peers, const struct ether_addr *_addr, struct awdl_peer **peer) {
-	int status;
-	map_t map = (map_t) peers;
-	mkey_t addr = (mkey_t) _addr;
-	status = hashmap_get(map, addr, (any_t *) peer, 0 /* keep */);
-	if (status == MAP_MISSING)
+enum peers_status awdl_peer_get(awdl_peers_t in, const struct ether_addr *addr, struct awdl_peer **peer) {
+	struct awdl_peers *peers = (struct awdl_peers *) in;
+	struct awdl_peer *found = awdl_peers_lookup(peers, peers_key(addr));
+	if (peer) /* may be NULL to only check for existence */
+		*peer = found;
+	if (!found)
 		return PEERS_MISSING;
 	return PEERS_OK;
 }
@@ -154,58 +505,119 @@ int awdl_peer_print(const struct awdl_peer *peer, char *str, int len) {
 
 int awdl_peers_print(awdl_peers_t peers, char *str, int len) {
 	char *cur = str, *const end = str + len;
-	map_t map = (map_t) peers;
-	map_it_t it = hashmap_it_new(map);
+	struct awdl_peers_it it;
 	struct awdl_peer *peer;
 
-	while (hashmap_it_next(it, NULL, (any_t *) &peer) == MAP_OK) {
+	awdl_peers_it_init(&it, peers);
+	while (awdl_peers_it_next(&it, &peer) == PEERS_OK) {
         cur += awdl_peer_print(peer, cur, end - cur);
         cur += snprintf(cur, cur < end ? end - cur : 0, "\n");
     }
 
-	hashmap_it_free(it);
 	return cur - str;
 }
 
-void awdl_peers_remove(awdl_peers_t peers, uint64_t before, awdl_peer_cb cb, void *arg) {
-	map_t map = (map_t) peers;
-	map_it_t it = hashmap_it_new(map);
-	struct awdl_peer *peer;
+/* Expire peers in one bucket of the timing wheel */
+static void peers_wheel_expire(struct awdl_peers *peers, uint32_t bucket, uint64_t before, awdl_peer_cb cb, void *arg) {
+	struct awdl_peer *peer = peers->wheel[bucket];
 
-	while (hashmap_it_next(it, NULL, (any_t *) &peer) == MAP_OK) {
+	while (peer) {
+		struct awdl_peer *next = peer->expiry_next;
 		if (peer->last_update < before) {
 			if (peer->is_valid) {
 				log_info("remove peer %s (%s)", ether_ntoa(&peer->addr), peer->name);
 				if (cb)
 					cb(peer, arg);
 			}
-			hashmap_it_remove(it);
-			free(peer);
+			awdl_peers_delete(peers, peer);
+		} else {
+			/* last_update was changed without awdl_peer_commit(), or peer is in a later round */
+			peers_wheel_update(peers, peer);
 		}
+		peer = next;
 	}
-	hashmap_it_free(it);
+}
+
+void awdl_peers_remove(awdl_peers_t in, uint64_t before, awdl_peer_cb cb, void *arg) {
+	struct awdl_peers *peers = (struct awdl_peers *) in;
+	uint64_t first = peers->wheel_tick;
+	uint64_t last = before >> PEERS_WHEEL_SHIFT;
+
+	/* all peers that could have expired are in buckets [first, last] */
+	if (last < first)
+		last = first;
+	/* peers that survive are at least as recent as tick last */
+	peers->wheel_tick = last;
+
+	if (last - first >= PEERS_WHEEL_SIZE) {
+		for (uint32_t bucket = 0; bucket < PEERS_WHEEL_SIZE; bucket++)
+			peers_wheel_expire(peers, bucket, before, cb, arg);
+	} else {
+		for (uint64_t tick = first; tick <= last; tick++)
+			peers_wheel_expire(peers, tick & PEERS_WHEEL_MASK, before, cb, arg);
+	}
+}
+
+uint64_t awdl_peers_oldest(awdl_peers_t in) {
+	struct awdl_peers *peers = (struct awdl_peers *) in;
+	uint64_t oldest = UINT64_MAX;
+
+	for (uint64_t tick = peers->wheel_tick; tick < peers->wheel_tick + PEERS_WHEEL_SIZE; tick++) {
+		for (struct awdl_peer *peer = peers->wheel[tick & PEERS_WHEEL_MASK]; peer; peer = peer->expiry_next) {
+			if (peer->last_update < oldest)
+				oldest = peer->last_update;
+		}
+		if (oldest != UINT64_MAX)
+			break;
+	}
+	return oldest;
+}
+
+void awdl_peers_it_init(struct awdl_peers_it *it, awdl_peers_t in) {
+	it->peers = in;
+	it->chunk = 0;
+	it->slot = -1;
 }
 
 awdl_peers_it_t awdl_peers_it_new(awdl_peers_t in) {
-	return (awdl_peers_it_t) hashmap_it_new((map_t) in);
+	struct awdl_peers_it *it = malloc(sizeof(struct awdl_peers_it));
+	if (!it)
+		return NULL;
+	awdl_peers_it_init(it, in);
+	return (awdl_peers_it_t) it;
 }
 
-enum peers_status awdl_peers_it_next(awdl_peers_it_t it, struct awdl_peer **peer) {
-	int s = hashmap_it_next((map_it_t) it, 0, (any_t *) peer);
-	if (s == MAP_OK)
-		return PEERS_OK;
-	else
-		return PEERS_MISSING;
+enum peers_status awdl_peers_it_next(awdl_peers_it_t in, struct awdl_peer **peer) {
+	struct awdl_peers_it *it = (struct awdl_peers_it *) in;
+	struct awdl_peers *peers = (struct awdl_peers *) it->peers;
+
+	/* peers are visited in slab order, which is stable under removal */
+	for (; it->chunk < peers->num_chunks; it->chunk++, it->slot = -1) {
+		struct peers_chunk *chunk = peers->chunks[it->chunk];
+		while (++it->slot < PEERS_CHUNK_SIZE) {
+			if (chunk->used & (1u << it->slot)) {
+				*peer = &chunk->peers[it->slot];
+				return PEERS_OK;
+			}
+		}
+	}
+	return PEERS_MISSING;
 }
 
-enum peers_status awdl_peers_it_remove(awdl_peers_it_t it) {
-	int s = hashmap_it_remove((map_it_t) it);
-	if (s == MAP_OK)
-		return PEERS_OK;
-	else
+enum peers_status awdl_peers_it_remove(awdl_peers_it_t in) {
+	struct awdl_peers_it *it = (struct awdl_peers_it *) in;
+	struct awdl_peers *peers = (struct awdl_peers *) it->peers;
+	struct peers_chunk *chunk;
+
+	if (it->chunk >= peers->num_chunks || it->slot < 0)
+		return PEERS_MISSING;
+	chunk = peers->chunks[it->chunk];
+	if (!(chunk->used & (1u << it->slot)))
 		return PEERS_MISSING;
+	awdl_peers_delete(peers, &chunk->peers[it->slot]);
+	return PEERS_OK;
 }
 
 void awdl_peers_it_free(awdl_peers_it_t it) {
-	hashmap_it_free((map_it_t) it);
+	free(it);
 }
@@ -21,18 +21,23 @@
 #define AWDL_PEERS_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <net/ethernet.h>
 
 #include "election.h"
 #include "channel.h"
+#include "circular_buffer.h"
 
 #define HOST_NAME_LENGTH_MAX 64
+#define AWDL_DATA_HDR_MAX_LEN 64
 
 enum peers_status {
+	PEERS_VALID = 2, /* Peer turned valid */
 	PEERS_UPDATE = 1, /* Peer updated */
 	PEERS_OK = 0, /* New peer added */
 	PEERS_MISSING = -1, /* Peer does not exist */
 	PEERS_INTERNAL = -2, /* Internal error */
+	PEERS_REJECTED = -3, /* Peer not admitted (yet) */
 };
 
 struct awdl_peer {
@@ -40,7 +45,12 @@ struct awdl_peer {
 	uint64_t last_update;
 	struct awdl_election_state election;
 	struct awdl_chan sequence[AWDL_CHANSEQ_LENGTH];
-	uint64_t sync_offset;
+	/* bit i is set if we share a non-zero channel in our slot i, see awdl_peer_update_overlap */
+	uint16_t overlap;
+	/* slots from our slot i until the next common slot, AWDL_CHANSEQ_LENGTH if there is none */
+	uint8_t next_overlap[AWDL_CHANSEQ_LENGTH];
+	/* the peer's schedule is ahead of ours by this much (in us), see awdl_peer_update_sync */
+	int64_t sync_offset;
 	char name[HOST_NAME_LENGTH_MAX + 1]; /* space for trailing zero */
 	char country_code[2 + 1];
 	struct ether_addr infra_addr;
@@ -49,6 +59,16 @@ struct awdl_peer {
 	uint8_t supports_v2 : 1;
 	uint8_t sent_mif : 1;
 	uint8_t is_valid : 1;
+	uint8_t sync_valid : 1; /* sync_offset has been measured */
+	/* headers for data frames to this peer, built on first use, see awdl_init_data_hdr */
+	uint8_t data_hdr[AWDL_DATA_HDR_MAX_LEN];
+	uint8_t data_hdr_len;
+	/* unicast frames (struct buf) waiting to be sent to this peer, created on first use */
+	cbuf_handle_t tx_queue;
+	/* expiry timing wheel, see awdl_peers_remove() */
+	struct awdl_peer *expiry_next;
+	struct awdl_peer **expiry_pprev;
+	uint64_t expiry_tick;
 };
 
 typedef void (*awdl_peer_cb)(struct awdl_peer *, void *arg);
@@ -59,6 +79,11 @@ struct awdl_peer_state {
 	awdl_peers_t peers;
 	uint64_t timeout;
 	uint64_t clean_interval;
+	/* admission control, see awdl_peer_admit() */
+	uint32_t max_peers; /* 0 for no limit */
+	uint32_t admit_frames; /* frames from an unknown address (within timeout) before it becomes a peer */
+	uint32_t admit_budget; /* new peers per admit_window, 0 for no limit */
+	uint64_t admit_window; /* in us */
 };
 
 void awdl_peer_state_init(struct awdl_peer_state *state);
@@ -72,14 +97,56 @@ int awdl_peers_length(awdl_peers_t peers);
 enum peers_status
 awdl_peer_add(awdl_peers_t peers, const struct ether_addr *addr, uint64_t now, awdl_peer_cb cb, void *arg);
 
+/**
+ * Find or create a peer with a single lookup, use awdl_peer_commit() once the peer has been updated
+ * @param peers the awdl_peers_t instance
+ * @param addr address of the peer
+ * @param now used as {@code last_update} for a new peer
+ * @param peer is set to the existing or new peer
+ * @return PEERS_OK if the peer was created, PEERS_UPDATE if it existed, or a negative value on failure
+ */
+enum peers_status
+awdl_peer_upsert(awdl_peers_t peers, const struct ether_addr *addr, uint64_t now, struct awdl_peer **peer);
+
+/* Set {@code last_update} and keep the expiry timing wheel in sync, never write {@code last_update} directly */
+void awdl_peer_touch(awdl_peers_t peers, struct awdl_peer *peer, uint64_t now);
+
+/**
+ * Create a peer for a previously unknown address, subject to the limits in {@code state}.
+ * Addresses are only admitted after {@code admit_frames} frames and if the budget of the
+ * current window allows. If the table is full, the least recently updated peer that never
+ * turned valid is evicted, or the least recently updated valid peer if there is none.
+ * Right after awdl_peer_get() missed {@code addr}, the index is not probed again.
+ * @param state the peer state including the limits
+ * @param addr address of the peer, must not be in the table yet
+ * @param now current time, used as {@code last_update} for the new peer
+ * @param peer is set to the new peer
+ * @param evict_cb called for each evicted peer before it is removed, can be NULL
+ * @param arg will be passed to {@code evict_cb}
+ * @return PEERS_OK if the peer was created, PEERS_REJECTED if not admitted, or another negative value on failure
+ */
+enum peers_status awdl_peer_admit(struct awdl_peer_state *state, const struct ether_addr *addr, uint64_t now,
+                                  struct awdl_peer **peer, awdl_peer_cb evict_cb, void *arg);
+
+/**
+ * Mark a peer as updated and call {@code cb} if it has turned valid
+ * @return PEERS_VALID if the peer has turned valid, PEERS_UPDATE otherwise
+ */
+enum peers_status
+awdl_peer_commit(awdl_peers_t peers, struct awdl_peer *peer, uint64_t now, awdl_peer_cb cb, void *arg);
+
 enum peers_status awdl_peer_remove(awdl_peers_t peers, const struct ether_addr *addr, awdl_peer_cb cb, void *arg);
 
 enum peers_status awdl_peer_get(awdl_peers_t peers, const struct ether_addr *addr, struct awdl_peer **peer);
 
 int awdl_peer_print(const struct awdl_peer *peer, char *str, int len);
 
+/* Granularity of the expiry timing wheel in us */
+#define PEERS_EXPIRY_RESOLUTION (1 << 14)
+
 /**
- * Apply callback to and then remove all peers matching a filter
+ * Apply callback to and then remove all peers matching a filter.
+ * Only visits peers that were last updated close to or before {@code before}.
  * @param peers the awdl_peers_t instance
  * @param before remove all entries with an last_update timestamp {@code before}
  * @param cb the callback function, can be NULL
@@ -87,11 +154,30 @@ int awdl_peer_print(const struct awdl_peer *peer, char *str, int len);
  */
 void awdl_peers_remove(awdl_peers_t peers, uint64_t before, awdl_peer_cb cb, void *arg);
 
+/**
+ * Oldest {@code last_update} in the peer table, found without visiting all peers
+ * @return the timestamp or UINT64_MAX if there are no peers
+ */
+uint64_t awdl_peers_oldest(awdl_peers_t peers);
+
 int awdl_peers_print(awdl_peers_t peers, char *str, int len);
 
 /* Iterator functions */
 typedef void *awdl_peers_it_t;
 
+/**
+ * Iterator state, can be allocated on the stack and set up with awdl_peers_it_init().
+ * Its members are internal.
+ */
+struct awdl_peers_it {
+	awdl_peers_t peers;
+	uint32_t chunk;
+	int slot; /* current position, -1 before first call to next */
+};
+
+/* Initialize an iterator without allocating memory, does not need to be freed */
+void awdl_peers_it_init(struct awdl_peers_it *it, awdl_peers_t in);
+
 awdl_peers_it_t awdl_peers_it_new(awdl_peers_t in);
 
 enum peers_status awdl_peers_it_next(awdl_peers_it_t it, struct awdl_peer **peer);
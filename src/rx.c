@@ -26,31 +26,33 @@
 
 #include "rx.h"
 #include "sync.h"
+#include "schedule.h"
 #include "wire.h"
 #include "log.h"
 
-#define AWDL_SYNC_THRESHOLD 3
-
 int awdl_handle_sync_params_tlv(struct awdl_peer *src, const struct buf *val, struct awdl_state *state, uint64_t now) {
 	uint16_t aw_counter_master;
 	uint16_t time_to_next_aw_master;
 	int64_t sync_err_tu;
 
-	if (!awdl_election_is_sync_master(&state->election, &src->addr))
-		return RX_IGNORE; /* ignore sync params from nodes that are not our master */
-
-	/* TODO synchronization could be more accurate */
-
 	READ_LE16(val, 1, &time_to_next_aw_master);
 	READ_LE16(val, 29, &aw_counter_master);
 
+	if (!awdl_election_is_sync_master(&state->election, &src->addr)) {
+		/* do not follow nodes that are not our master, but keep track of where their slots are */
+		awdl_peer_update_sync(state, src, now, time_to_next_aw_master, aw_counter_master);
+		return RX_OK;
+	}
+
 	state->sync.meas_total++;
 	sync_err_tu = awdl_sync_error_tu(now, time_to_next_aw_master, aw_counter_master, &state->sync);
+	awdl_sync_meas_err(&state->sync, sync_err_tu);
 	if (sync_err_tu > AWDL_SYNC_THRESHOLD || sync_err_tu < -AWDL_SYNC_THRESHOLD) {
 		state->sync.meas_err++;
 		log_trace("Sync error %d TU (%.02f %%)", sync_err_tu, state->sync.meas_err * 100.0 / state->sync.meas_total);
 	}
-	awdl_sync_update_last(now, time_to_next_aw_master, aw_counter_master, &state->sync);
+	awdl_sync_update(now, time_to_next_aw_master, aw_counter_master, &src->addr, &state->sync);
+	awdl_peer_update_sync(state, src, now, time_to_next_aw_master, aw_counter_master);
 
 	return RX_OK;
 wire_error:
@@ -58,7 +60,7 @@ wire_error:
 }
 
 int awdl_handle_chanseq_tlv(struct awdl_peer *src, const struct buf *val,
-                            struct awdl_state *state __attribute__((unused))) {
+                            struct awdl_state *state) {
 	uint8_t count;
 	uint8_t encoding;
 	uint8_t duplicate_count;
@@ -101,6 +103,7 @@ int awdl_handle_chanseq_tlv(struct awdl_peer *src, const struct buf *val,
 		          awdl_chan_num(list[12], encoding), awdl_chan_num(list[13], encoding),
 		          awdl_chan_num(list[14], encoding), awdl_chan_num(list[15], encoding));
 		memcpy(src->sequence, list, sizeof(list));
+		awdl_peer_update_overlap(state, src);
 	}
 	return RX_OK;
 
@@ -250,15 +253,35 @@ wire_error:
 	return -1;
 }
 
+static int awdl_election_params_equal(const struct awdl_election_state *a, const struct awdl_election_state *b) {
+	return !compare_ether_addr(&a->master_addr, &b->master_addr) &&
+	       !compare_ether_addr(&a->sync_addr, &b->sync_addr) &&
+	       a->height == b->height &&
+	       a->master_metric == b->master_metric &&
+	       a->master_counter == b->master_counter;
+}
+
+static void awdl_peer_evicted(struct awdl_peer *peer, void *arg) {
+	struct awdl_state *state = arg;
+	state->stats.peers_evicted++;
+	if (peer->is_valid) {
+		log_info("remove peer %s (%s)", ether_ntoa(&peer->addr), peer->name);
+		if (state->peer_remove_cb)
+			state->peer_remove_cb(peer, state->peer_remove_cb_data);
+	}
+}
+
 int awdl_rx_action(const struct buf *frame, signed char rssi, uint64_t tsft,
                    const struct ether_addr *src, const struct ether_addr *dst,
                    struct awdl_state *state) {
 	int len;
 	enum peers_status status;
+	int known;
 	uint8_t tlv_type;
 	uint16_t tlv_len;
 	const uint8_t *tlv_value;
 	struct awdl_peer *peer;
+	struct awdl_election_state election;
 	int subtype;
 
 	(void) dst; /* TODO ignore destination address for now, could be used to mitigate desynchronization attack */
@@ -270,34 +293,39 @@ int awdl_rx_action(const struct buf *frame, signed char rssi, uint64_t tsft,
 	}
 	buf_strip(frame, sizeof(struct awdl_action));
 
+	/* Update peer table, unknown addresses have to pass the RSSI filter and admission control */
+	known = awdl_peer_get(state->peers.peers, src, &peer) == PEERS_OK;
+
 	if (state->filter_rssi) {
-		status = awdl_peer_get(state->peers.peers, src, NULL);
-		if (((status == PEERS_OK) && rssi < state->rssi_threshold + state->rssi_grace) ||
-		    ((status == PEERS_MISSING) && rssi < state->rssi_threshold))
+		if ((known && rssi < state->rssi_threshold + state->rssi_grace) ||
+		    (!known && rssi < state->rssi_threshold))
 			return RX_IGNORE_RSSI;
 	}
-	state->stats.rx_action++;
 
-	/* Update peer table */
-	status = awdl_peer_add(state->peers.peers, src, tsft, state->peer_cb, state->peer_cb_data);
-	if (status < 0) {
-		log_warn("awdl_action: could not add peer: %s (%d)", ether_ntoa(src), status);
-		return RX_IGNORE;
-	}
-	status = awdl_peer_get(state->peers.peers, src, &peer);
-	if (status < 0) {
-		log_warn("awdl_action: could not find peer: %s (%d)", ether_ntoa(src), status);
-		return RX_IGNORE; /* FIXME happens sometimes, not sure why */
+	if (!known) { /* reuses the index probe of awdl_peer_get() */
+		status = awdl_peer_admit(&state->peers, src, tsft, &peer, awdl_peer_evicted, state);
+		if (status == PEERS_REJECTED) {
+			log_trace("awdl_action: not admitting %s", ether_ntoa(src));
+			state->stats.peers_rejected++;
+			return RX_IGNORE_PEER;
+		} else if (status < 0) {
+			log_warn("awdl_action: could not add peer: %s (%d)", ether_ntoa(src), status);
+			return RX_IGNORE;
+		}
+		awdl_election_check(&state->election, &state->peers); /* could have evicted our sync master */
 	}
+	state->stats.rx_action++;
+	awdl_peer_touch(state->peers.peers, peer, tsft); /* even if we cannot parse the rest */
+	election = peer->election;
 
 	log_trace("awdl_action: receive %s from %s (rssi %d)", awdl_frame_as_str(subtype), ether_ntoa(&peer->addr), rssi);
 
 	while ((len = read_tlv(frame, 0, &tlv_type, &tlv_len, &tlv_value)) > 0) {
-		const struct buf *tlv_buf = buf_new_const(tlv_value, tlv_len);
+		struct buf tlv_view;
+		const struct buf *tlv_buf = buf_init_const(&tlv_view, tlv_value, tlv_len);
 		int result = awdl_handle_tlv(peer, tlv_type, tlv_buf, state, tsft);
 		if (state->tlv_cb)
 			state->tlv_cb(peer, tlv_type, tlv_buf, state, state->tlv_cb_data);
-		buf_free(tlv_buf);
 		if (result < 0) {
 			log_warn("awdl_action: parsing error %s", awdl_tlv_as_str(tlv_type));
 			return RX_UNEXPECTED_FORMAT;
@@ -314,7 +342,11 @@ int awdl_rx_action(const struct buf *frame, signed char rssi, uint64_t tsft,
 		peer->sent_mif = 1;
 
 	/* update peer info after parsing all TLVs */
-	awdl_peer_add(state->peers.peers, src, tsft, state->peer_cb, state->peer_cb_data);
+	status = awdl_peer_commit(state->peers.peers, peer, tsft, state->peer_cb, state->peer_cb_data);
+
+	/* only re-evaluate the election if something relevant has changed */
+	if (status == PEERS_VALID || !awdl_election_params_equal(&election, &peer->election))
+		awdl_election_update(&state->election, &state->peers, peer);
 
 	return RX_OK;
 }
@@ -350,10 +382,10 @@ int awdl_valid_llc_header(const struct buf *frame) {
 	return 1;
 }
 
-int awdl_rx_data(const struct buf *frame, struct buf ***out, const struct ether_addr *src,
-                 const struct ether_addr *dst, struct awdl_state *state) {
+int awdl_rx_data(const struct buf *frame, const struct ether_addr *src, const struct ether_addr *dst,
+                 struct awdl_state *state) {
+	struct ether_header eth;
 	uint16_t ether_type;
-	int offset = 0;
 
 	log_trace("awdl_data: receive from %s", ether_ntoa(src));
 	state->stats.rx_data++;
@@ -370,32 +402,28 @@ int awdl_rx_data(const struct buf *frame, struct buf ***out, const struct ether_
 		return RX_TOO_SHORT;
 	}
 
-	/* create ethernet frame */
+	/* create ethernet header, payload is passed on as is */
 	read_be16(frame, 6, &ether_type);
 	buf_strip(frame, sizeof(struct awdl_data));
 
-	**out = buf_new_owned(ETHER_MAX_LEN);
-
-	/* TODO use checked write methods */
-	offset += write_ether_addr(**out, offset, dst);
-	offset += write_ether_addr(**out, offset, src);
-	offset += write_be16(**out, offset, ether_type);
-	/* TODO avoid copying bytes */
-	offset += write_bytes(**out, offset, buf_data(frame), buf_len(frame));
+	memcpy(eth.ether_dhost, dst, ETHER_ADDR_LEN);
+	memcpy(eth.ether_shost, src, ETHER_ADDR_LEN);
+	eth.ether_type = htobe16(ether_type);
 
-	(*out)++;
+	if (state->data_cb)
+		state->data_cb(&eth, frame, state->data_cb_data);
 
 	return RX_OK;
 }
 
-int awdl_rx_data_amsdu(const struct buf *frame, struct buf ***out, const struct ether_addr *src __attribute__((unused)),
+int awdl_rx_data_amsdu(const struct buf *frame, const struct ether_addr *src __attribute__((unused)),
                        const struct ether_addr *dst __attribute__((unused)), struct awdl_state *state) {
 	/* Iterate over all subframes */
 	while (buf_len(frame) > 0) {
 		struct ether_addr src_a, dst_a;
 		uint16_t len_a;
 		int err;
-		const struct buf *subframe;
+		struct buf subframe;
 		READ_ETHER_ADDR(frame, 0, &dst_a);
 		READ_ETHER_ADDR(frame, 6, &src_a);
 		READ_BE16(frame, 12, &len_a);
@@ -403,9 +431,8 @@ int awdl_rx_data_amsdu(const struct buf *frame, struct buf ***out, const struct
 		if (len_a > buf_len(frame))
 			return RX_TOO_SHORT;
 		/* create subview of buf */
-		subframe = buf_new_const(buf_data(frame), len_a);
-		err = awdl_rx_data(subframe, out, &src_a, &dst_a, state);
-		buf_free(subframe);
+		buf_init_const(&subframe, buf_data(frame), len_a);
+		err = awdl_rx_data(&subframe, &src_a, &dst_a, state);
 		if (err < 0)
 			return err;
 		BUF_STRIP(frame, len_a); /* strip frame */
@@ -417,6 +444,17 @@ wire_error:
 	return RX_TOO_SHORT;
 }
 
+/* Our own action frames are echoed on the monitor interface once sent, measure how long that took */
+static void awdl_rx_own_action(const struct buf *frame, uint64_t now, struct awdl_state *state) {
+	const struct awdl_action *af;
+
+	if (awdl_parse_action_hdr(frame) < 0)
+		return;
+	af = (const struct awdl_action *) buf_data(frame);
+	/* target_tx is the time the frame was built (lower 32 bits), see awdl_init_action() */
+	awdl_sync_tx_delay_update(&state->sync, (uint32_t) ((uint32_t) now - le32toh(af->target_tx)));
+}
+
 static int radiotap_parse(const struct buf *frame, signed char *rssi, uint8_t *flags, uint64_t *tsft) {
 	struct ieee80211_radiotap_iterator iter;
 	int err;
@@ -463,7 +501,7 @@ wire_error:
 	return -1;
 }
 
-int awdl_rx(const struct buf *frame, struct buf ***data_frame, struct awdl_state *state) {
+int awdl_rx(const struct buf *frame, uint64_t now, struct awdl_state *state) {
 	const struct ieee80211_hdr *ieee80211;
 	const struct ether_addr *from, *to;
 	uint16_t fc, qosc; /* frame and QoS control */
@@ -471,9 +509,14 @@ int awdl_rx(const struct buf *frame, struct buf ***data_frame, struct awdl_state
 	uint64_t tsft;
 	uint8_t flags;
 
-	tsft = clock_time_us(); /* TODO Radiotap TSFT is more accurate but then need to access TSF in clock_time_us() */
-	if (radiotap_parse(frame, &rssi, &flags, NULL /* &tsft */) < 0)
+	tsft = 0; /* not present */
+	flags = 0;
+	if (radiotap_parse(frame, &rssi, &flags, &tsft) < 0)
 		return RX_UNEXPECTED_FORMAT;
+	if (tsft)
+		tsft = awdl_sync_tsf_to_local(&state->sync, tsft, now);
+	else
+		tsft = now;
 	BUF_STRIP(frame, le16toh(((const struct ieee80211_radiotap_header *) buf_data(frame))->it_len));
 
 	if (check_fcs(frame, flags)) /* note that if no flags are present (flags==0), frames will pass */
@@ -486,8 +529,13 @@ int awdl_rx(const struct buf *frame, struct buf ***data_frame, struct awdl_state
 	to = &ieee80211->addr1;
 	fc = le16toh(ieee80211->frame_control);
 
-	if (!memcmp(from, &state->self_address, sizeof(struct ether_addr)))
+	if (!memcmp(from, &state->self_address, sizeof(struct ether_addr))) {
+		if ((fc & (IEEE80211_FCTL_FTYPE | IEEE80211_FCTL_STYPE)) == (IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_ACTION)) {
+			BUF_STRIP(frame, sizeof(struct ieee80211_hdr));
+			awdl_rx_own_action(frame, tsft, state);
+		}
 		return RX_IGNORE_FROM_SELF; /* TODO ignore frames from self, should be filtered at pcap level */
+	}
 
 	//if (!(to->ether_addr_octet[0] & 0x01) && memcmp(to, &state->self_address, sizeof(struct ether_addr)))
 	//	return RX_IGNORE_NOPROMISC; /* neither broadcast/multicast nor unicast to me */
@@ -503,10 +551,10 @@ int awdl_rx(const struct buf *frame, struct buf ***data_frame, struct awdl_state
 			BUF_STRIP(frame, IEEE80211_QOS_CTL_LEN);
 			/* TODO should handle block acks if required (IEEE80211_QOS_CTL_ACK_POLICY_XYZ) */
 			if (qosc & IEEE80211_QOS_CTL_A_MSDU_PRESENT)
-				return awdl_rx_data_amsdu(frame, data_frame, from, to, state);
+				return awdl_rx_data_amsdu(frame, from, to, state);
 			/* else fall through */
 		case IEEE80211_FTYPE_DATA | IEEE80211_STYPE_DATA:
-			return awdl_rx_data(frame, data_frame, from, to, state);
+			return awdl_rx_data(frame, from, to, state);
 		default:
 			log_warn("ieee80211: cannot handle type %x and subtype %x of received frame from %s",
 			         fc & IEEE80211_FCTL_FTYPE, fc & IEEE80211_FCTL_STYPE, ether_ntoa(from));
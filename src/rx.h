@@ -64,19 +64,22 @@ int awdl_rx_action(const struct buf *frame, signed char rssi, uint64_t tsft,
 int llc_parse(const struct buf *frame, struct llc_hdr *llc);
 int awdl_valid_llc_header(const struct buf *frame);
 
-int awdl_rx_data(const struct buf *frame, struct buf ***out,
-                 const struct ether_addr *src, const struct ether_addr *dst, struct awdl_state *state);
+int awdl_rx_data(const struct buf *frame, const struct ether_addr *src, const struct ether_addr *dst,
+                 struct awdl_state *state);
 
-int awdl_rx_data_amsdu(const struct buf *frame, struct buf ***out,
-                       const struct ether_addr *src, const struct ether_addr *dst, struct awdl_state *state);
+int awdl_rx_data_amsdu(const struct buf *frame, const struct ether_addr *src, const struct ether_addr *dst,
+                       struct awdl_state *state);
 
 /** @brief Receive and process AWDL action and data frame
+ *
+ * Data frames are converted to Ethernet frames and passed to {@code state->data_cb}
+ * without copying the payload.
  *
  * @param frame input frame
- * @param data if {@code frame} points to a valid AWDL data frame, will point to converted Ethernet frame after function returns
+ * @param now reception time in us (see clock_time_us()), refined with the radiotap TSFT if present
  * @param state
  * @return RX_OK
  */
-int awdl_rx(const struct buf *frame, struct buf ***data_frames, struct awdl_state *state);
+int awdl_rx(const struct buf *frame, uint64_t now, struct awdl_state *state);
 
 #endif /* AWDL_RX_H_ */
@@ -27,17 +27,89 @@ uint64_t sec_to_usec(double sec) {
 	return sec * 1000000;
 }
 
-bool awdl_same_channel_as_peer(const struct awdl_state *state, uint64_t now, const struct awdl_peer *peer) {
-	int own_slot, peer_slot;
-	int own_chan, peer_chan;
+/* Peer slot that corresponds to our slot 0 */
+static int awdl_peer_slot_shift(const struct awdl_state *state, int64_t offset) {
+	int64_t eaw_len = ieee80211_tu_to_usec(state->sync.presence_mode * state->sync.aw_period);
+	int shift;
+
+	shift = (int) (((offset < 0 ? offset - eaw_len / 2 : offset + eaw_len / 2) / eaw_len) % AWDL_CHANSEQ_LENGTH);
+	if (shift < 0)
+		shift += AWDL_CHANSEQ_LENGTH;
+	return shift;
+}
+
+void awdl_peer_update_overlap(const struct awdl_state *state, struct awdl_peer *peer) {
+	int shift = awdl_peer_slot_shift(state, peer->sync_offset);
+
+	peer->overlap = 0;
+	for (int i = 0; i < AWDL_CHANSEQ_LENGTH; i++) {
+		int own_chan = awdl_chan_num(state->channel.sequence[i], state->channel.enc);
+		int peer_chan = awdl_chan_num(peer->sequence[(i + shift) % AWDL_CHANSEQ_LENGTH], state->channel.enc);
+		if (own_chan && (own_chan == peer_chan))
+			peer->overlap |= 1 << i;
+	}
+
+	/* walk backwards twice so that every slot sees the next common slot, also across wrap-around */
+	uint8_t next = AWDL_CHANSEQ_LENGTH;
+	for (int i = 2 * AWDL_CHANSEQ_LENGTH - 1; i >= 0; i--) {
+		int slot = i % AWDL_CHANSEQ_LENGTH;
+		if (peer->overlap & (1 << slot))
+			next = 0;
+		else if (next < AWDL_CHANSEQ_LENGTH)
+			next++;
+		peer->next_overlap[slot] = next;
+	}
+}
+
+/* Wrap {@code offset} into one period of the channel sequence, centered around zero */
+static int64_t awdl_chanseq_wrap(const struct awdl_state *state, int64_t offset) {
+	int64_t period = ieee80211_tu_to_usec(state->sync.presence_mode * state->sync.aw_period) * AWDL_CHANSEQ_LENGTH;
+
+	offset %= period;
+	if (offset >= period / 2)
+		offset -= period;
+	else if (offset < -period / 2)
+		offset += period;
+	return offset;
+}
+
+void awdl_peer_update_sync(const struct awdl_state *state, struct awdl_peer *peer, uint64_t now,
+                           uint16_t time_to_next_aw, uint16_t aw_counter) {
+	int64_t eaw_len = ieee80211_tu_to_usec(state->sync.presence_mode * state->sync.aw_period);
+	int64_t offset = awdl_chanseq_wrap(state, awdl_sync_error_us(now, time_to_next_aw, aw_counter, &state->sync));
+	int64_t diff = awdl_chanseq_wrap(state, offset - peer->sync_offset);
+	int shift = awdl_peer_slot_shift(state, peer->sync_offset);
+
+	if (!peer->sync_valid || diff > eaw_len / 2 || diff < -eaw_len / 2) {
+		/* first measurement or the peer (re)synced to another master */
+		peer->sync_offset = offset;
+		peer->sync_valid = 1;
+	} else {
+		/* average out the TU resolution of the peer's values and our own frequency corrections */
+		peer->sync_offset = awdl_chanseq_wrap(state, peer->sync_offset + diff / AWDL_PEER_SYNC_SMOOTHING);
+	}
+
+	if (awdl_peer_slot_shift(state, peer->sync_offset) != shift)
+		awdl_peer_update_overlap(state, peer);
+}
 
-	own_slot = awdl_sync_current_eaw(now, &state->sync) % AWDL_CHANSEQ_LENGTH;
-	peer_slot = awdl_sync_current_eaw(now + peer->sync_offset, &state->sync) % AWDL_CHANSEQ_LENGTH;
+uint64_t awdl_next_overlap_in_us(const struct awdl_state *state, const struct awdl_peer *peer, uint64_t now) {
+	uint64_t eaw_len = ieee80211_tu_to_usec(state->sync.presence_mode * state->sync.aw_period);
+	struct awdl_slot slot;
+	uint8_t next;
 
-	own_chan = awdl_chan_num(state->channel.sequence[own_slot], state->channel.enc);
-	peer_chan = awdl_chan_num(peer->sequence[peer_slot], state->channel.enc);
+	awdl_slot_at(&state->sync, now, &slot);
+	next = peer->next_overlap[slot.index];
+	if (next == 0)
+		return 0;
+	if (next == AWDL_CHANSEQ_LENGTH)
+		return UINT64_MAX;
+	return slot.end + (next - 1) * eaw_len - now;
+}
 
-	return own_chan && (own_chan == peer_chan);
+bool awdl_same_channel_as_peer(const struct awdl_state *state, uint64_t now, const struct awdl_peer *peer) {
+	int own_slot = awdl_sync_current_eaw(now, &state->sync) % AWDL_CHANSEQ_LENGTH;
+	return peer->overlap & (1 << own_slot);
 }
 
 int awdl_is_multicast_eaw(const struct awdl_state *state, uint64_t now) {
@@ -45,36 +117,86 @@ int awdl_is_multicast_eaw(const struct awdl_state *state, uint64_t now) {
 	return slot == 0 || slot == 10;
 }
 
-double awdl_can_send_in(const struct awdl_state *state, uint64_t now, int guard) {
+void awdl_slot_at(const struct awdl_sync_state *sync, uint64_t now, struct awdl_slot *slot) {
+	uint64_t len = ieee80211_tu_to_usec(sync->presence_mode * sync->aw_period);
+	slot->end = now + awdl_sync_next_aw_us(now, sync);
+	slot->start = slot->end - len;
+	/* evaluate in the middle of the slot so that TU rounding cannot move us into a neighboring one */
+	slot->eaw = awdl_sync_current_eaw(slot->start + len / 2, sync);
+	slot->index = slot->eaw % AWDL_CHANSEQ_LENGTH;
+}
+
+int64_t awdl_can_send_in_us(const struct awdl_state *state, uint64_t now, uint64_t _guard) {
 	uint64_t next_aw = awdl_sync_next_aw_us(now, &state->sync);
-	uint64_t _guard = ieee80211_tu_to_usec(guard);
 	uint64_t eaw = ieee80211_tu_to_usec(64);
 
-	return (next_aw < _guard) ? -usec_to_sec(_guard - next_aw) : ((eaw - next_aw < _guard) ? usec_to_sec(
-		(_guard - (eaw - next_aw))) : 0);
+	return (next_aw < _guard) ? -(int64_t) (_guard - next_aw) : ((eaw - next_aw < _guard) ?
+		(int64_t) (_guard - (eaw - next_aw)) : 0);
 }
 
-double awdl_can_send_unicast_in(const struct awdl_state *state, const struct awdl_peer *peer, uint64_t now, int guard) {
+int64_t awdl_can_send_unicast_in_us(const struct awdl_state *state, const struct awdl_peer *peer, uint64_t now,
+                                    uint64_t _guard) {
 	uint64_t next_aw = awdl_sync_next_aw_us(now, &state->sync);
-	uint64_t _guard = ieee80211_tu_to_usec(guard);
 	uint64_t eaw = ieee80211_tu_to_usec(64);
 
-	if (!awdl_same_channel_as_peer(state, now, peer))
-		return usec_to_sec(next_aw); /* try again in the next slot */
+	if (!awdl_same_channel_as_peer(state, now, peer)) {
+		uint64_t in = awdl_next_overlap_in_us(state, peer, now);
+		return (in == UINT64_MAX) ? next_aw : in; /* try again in the next common slot */
+	}
 
 	if (next_aw < _guard) { /* we are at the end of slot */
 		if (awdl_same_channel_as_peer(state, now + eaw, peer)) {
 			return 0; /* we are on the same channel in next slot, ignore guard */
 		} else {
-			return -usec_to_sec(_guard - next_aw);
+			return -(int64_t) (_guard - next_aw);
 		}
 	} else if (eaw - next_aw < _guard) {
 		if (awdl_same_channel_as_peer(state, now - eaw, peer)) {
 			return 0; /* we were on the same channel last slot, ignore guard */
 		} else {
-			return usec_to_sec(_guard - (eaw - next_aw));
+			return _guard - (eaw - next_aw);
 		}
 	} else {
 		return 0; /* we are inside guard interval */
 	}
 }
+
+void awdl_guard_init(struct awdl_guard_state *guard) {
+	guard->unicast = ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU);
+	guard->multicast = ieee80211_tu_to_usec(AWDL_MULTICAST_GUARD_TU);
+	guard->switch_latency = 0;
+	guard->switch_samples = 0;
+}
+
+static uint64_t clamp(uint64_t val, uint64_t min, uint64_t max) {
+	return (val < min) ? min : ((val > max) ? max : val);
+}
+
+void awdl_guard_update(struct awdl_state *state, uint64_t switch_latency) {
+	struct awdl_guard_state *guard = &state->guard;
+	const struct awdl_sync_state *sync = &state->sync;
+	uint64_t uncertainty;
+
+	if (switch_latency) {
+		if (!guard->switch_samples)
+			guard->switch_latency = switch_latency;
+		else
+			guard->switch_latency = (7 * (uint64_t) guard->switch_latency + switch_latency) / 8;
+		guard->switch_samples++;
+	}
+
+	if (!guard->switch_samples ||
+	    (uint64_t) sync->meas_err_rate * 100 > (uint64_t) AWDL_SYNC_ERR_RATE_ONE * AWDL_GUARD_SYNC_ERR_RATE_MAX) {
+		guard->unicast = ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU);
+		guard->multicast = ieee80211_tu_to_usec(AWDL_MULTICAST_GUARD_TU);
+		return;
+	}
+
+	/* we need to be on the channel before the peer starts sending and may be off by the sync error */
+	uncertainty = guard->switch_latency + sync->meas_err_avg;
+	guard->unicast = clamp(uncertainty + uncertainty / 4, AWDL_UNICAST_GUARD_MIN_US,
+	                       ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
+	/* multicast frames need to reach all peers, each with its own sync error */
+	guard->multicast = clamp(4 * uncertainty, AWDL_MULTICAST_GUARD_MIN_US,
+	                         ieee80211_tu_to_usec(AWDL_MULTICAST_GUARD_TU));
+}
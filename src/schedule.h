@@ -25,13 +25,77 @@
 #include "state.h"
 #include "peers.h"
 
+/* Upper bounds of the guard intervals, used until we have measurements */
 #define AWDL_UNICAST_GUARD_TU 3
 #define AWDL_MULTICAST_GUARD_TU 16
 
+/* Lower bounds of the guard intervals */
+#define AWDL_UNICAST_GUARD_MIN_US 512
+#define AWDL_MULTICAST_GUARD_MIN_US 4096
+
+/* Fall back to maximum guards if more recent sync errors exceed the threshold (in percent) */
+#define AWDL_GUARD_SYNC_ERR_RATE_MAX 10
+
+/* An extended availability window (EAW), i.e., one slot of the channel sequence */
+struct awdl_slot {
+	uint64_t start; /* in us */
+	uint64_t end; /* in us, start of the next slot */
+	uint16_t eaw; /* EAW counter */
+	uint8_t index; /* position in the channel sequence */
+};
+
 double usec_to_sec(uint64_t usec);
 
 uint64_t sec_to_usec(double sec);
 
+/**
+ * @brief Determine the slot that contains {@code now}.
+ * @param sync our synchronization state
+ * @param now current time in us
+ * @param slot is filled with the absolute boundaries of the slot
+ */
+void awdl_slot_at(const struct awdl_sync_state *sync, uint64_t now, struct awdl_slot *slot);
+
+/**
+ * @brief Precompute in which slots we share a channel with {@code peer}.
+ *
+ * Needs to be called whenever the peer's channel sequence or sync offset changes. Our own channel
+ * sequence is fixed once the state is initialized, i.e., before any peer is added.
+ * The sync offset is rounded to whole slots.
+ *
+ * @param state our state
+ * @param peer the peer, updates {@code overlap} and {@code next_overlap}
+ */
+void awdl_peer_update_overlap(const struct awdl_state *state, struct awdl_peer *peer);
+
+/* Weight (1/x) of a new measurement in the peer's smoothed sync offset */
+#define AWDL_PEER_SYNC_SMOOTHING 8
+
+/**
+ * @brief Track the phase of {@code peer}'s schedule from its sync parameters.
+ *
+ * Peers may follow another master or be in the middle of a resync, so we cannot assume that they share our
+ * schedule. Updates {@code sync_offset} and, if it moved by a slot, the overlap with our channel sequence.
+ *
+ * @param state our state
+ * @param peer the peer that sent the sync parameters
+ * @param now reception time in us
+ * @param time_to_next_aw the peer's time until its next AW in TU
+ * @param aw_counter the peer's AW sequence number
+ */
+void awdl_peer_update_sync(const struct awdl_state *state, struct awdl_peer *peer, uint64_t now,
+                           uint16_t time_to_next_aw, uint16_t aw_counter);
+
+/**
+ * @brief Time until we next share a channel with {@code peer}.
+ * @param state our state
+ * @param peer the other peer
+ * @param now current time in us
+ * @return 0 if we are on the same channel now, the time (in us) until the start of the next common slot,
+ *         or UINT64_MAX if our channel sequences do not overlap
+ */
+uint64_t awdl_next_overlap_in_us(const struct awdl_state *state, const struct awdl_peer *peer, uint64_t now);
+
 /**
  * @brief Determine whether we are on the same non-zero channel as {@code peer}.
  * @param state our state
@@ -62,11 +126,26 @@ int awdl_is_multicast_eaw(const struct awdl_state *state, uint64_t now);
  *  return when (^) is now
  *
  * @param state AWDL state
- * @param guard guard interval in TU
- * @return 0 if we are outside guard interval, or a positive or negative time in seconds
+ * @param guard guard interval in us
+ * @return 0 if we are outside guard interval, or a positive or negative time in us
  */
-double awdl_can_send_in(const struct awdl_state *state, uint64_t now, int guard);
+int64_t awdl_can_send_in_us(const struct awdl_state *state, uint64_t now, uint64_t guard);
+
+/* Same as awdl_can_send_in_us() but ignores the guard if {@code peer} stays on our channel */
+int64_t awdl_can_send_unicast_in_us(const struct awdl_state *state, const struct awdl_peer *peer, uint64_t now,
+                                    uint64_t guard);
 
-double awdl_can_send_unicast_in(const struct awdl_state *state, const struct awdl_peer *peer, uint64_t now, int guard);
+void awdl_guard_init(struct awdl_guard_state *guard);
+
+/**
+ * @brief Adapt guard intervals to the measured channel switch latency and sync error.
+ *
+ * Guards stay at their upper bounds until a switch latency has been measured or if
+ * synchronization is unreliable, and never drop below their lower bounds.
+ *
+ * @param state AWDL state, updates {@code state->guard}
+ * @param switch_latency measured latency (in us) of a channel switch, or 0 to only recompute
+ */
+void awdl_guard_update(struct awdl_state *state, uint64_t switch_latency);
 
 #endif /* AWDL_SCHEDULE_H_ */
@@ -22,6 +22,7 @@
 
 #include "version.h"
 #include "state.h"
+#include "schedule.h"
 
 #define ETHER_BROADCAST (struct ether_addr) {{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }}
 #define PSF_INTERVAL_MASTER_TU 110
@@ -41,6 +42,9 @@ void awdl_init_state(struct awdl_state *state, const char *hostname, const struc
 	state->tlv_cb = 0;
 	state->tlv_cb_data = 0;
 
+	state->data_cb = 0;
+	state->data_cb_data = 0;
+
 	state->peer_cb = 0;
 	state->peer_cb_data = 0;
 
@@ -59,6 +63,8 @@ void awdl_init_state(struct awdl_state *state, const char *hostname, const struc
 	//awdl_chanseq_init(state->channel.sequence);
 	awdl_chanseq_init_static(state->channel.sequence, &state->channel.master);
 
+	awdl_guard_init(&state->guard);
+
 	awdl_election_state_init(&state->election, self);
 
 	awdl_peer_state_init(&state->peers);
@@ -71,9 +77,14 @@ void awdl_stats_init(struct awdl_stats *stats) {
 	stats->tx_data = 0;
 	stats->tx_data_unicast = 0;
 	stats->tx_data_multicast = 0;
+	stats->tx_data_dropped = 0;
+	stats->tx_amsdu = 0;
+	stats->tx_amsdu_subframes = 0;
 	stats->rx_action = 0;
 	stats->rx_data = 0;
 	stats->rx_unknown = 0;
+	stats->peers_rejected = 0;
+	stats->peers_evicted = 0;
 }
 
 uint16_t awdl_state_next_sequence_number(struct awdl_state *state) {
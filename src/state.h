@@ -36,14 +36,30 @@ struct awdl_state; /* forward declaration for tlv_cb */
 
 typedef void (*awdl_tlv_cb)(struct awdl_peer *, uint8_t, const struct buf *, struct awdl_state *, void *);
 
+/* Ethernet frame split into header and payload, which points into the received frame */
+typedef void (*awdl_data_cb)(const struct ether_header *, const struct buf *, void *);
+
 struct awdl_stats {
 	uint64_t tx_action;
 	uint64_t tx_data;
 	uint64_t tx_data_unicast;
 	uint64_t tx_data_multicast;
+	uint64_t tx_data_dropped;
+	uint64_t tx_amsdu;
+	uint64_t tx_amsdu_subframes;
 	uint64_t rx_action;
 	uint64_t rx_data;
 	uint64_t rx_unknown;
+	uint64_t peers_rejected; /* unknown addresses not admitted to the peer table */
+	uint64_t peers_evicted; /* peers removed to make room for new ones */
+};
+
+/* Guard intervals at the slot boundaries, adapted at runtime by awdl_guard_update() */
+struct awdl_guard_state {
+	uint32_t unicast; /* in us */
+	uint32_t multicast; /* in us */
+	uint32_t switch_latency; /* smoothed channel switch latency in us */
+	uint32_t switch_samples;
 };
 
 /* Complete node state */
@@ -65,6 +81,10 @@ struct awdl_state {
 	awdl_tlv_cb tlv_cb;
 	void *tlv_cb_data;
 
+	/* Receives data frames converted to Ethernet frames */
+	awdl_data_cb data_cb;
+	void *data_cb_data;
+
 	/* Allows to hook adding of new neighbor */
 	awdl_peer_cb peer_cb;
 	void *peer_cb_data;
@@ -80,6 +100,7 @@ struct awdl_state {
 	struct awdl_election_state election;
 	struct awdl_sync_state sync;
 	struct awdl_channel_state channel;
+	struct awdl_guard_state guard;
 	struct awdl_peer_state peers;
 	struct awdl_stats stats;
 };
@@ -17,6 +17,8 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "sync.h"
 #include "ieee80211.h"
 
@@ -26,27 +28,65 @@ void awdl_sync_state_init(struct awdl_sync_state *state, uint64_t now) {
 	state->aw_period = 16;
 	state->presence_mode = 4;
 
+	memset(&state->master, 0, sizeof(state->master));
+	state->locked = 0;
+	state->freq_ppb = 0;
+	state->last_sync = now;
+
+	state->tsf_offset = 0;
+	state->tsf_valid = 0;
+	state->tsf_last = now;
+
+	state->tx_delay = 0;
+	state->tx_delay_samples = 0;
+
 	state->meas_err = 0;
 	state->meas_total = 0;
+	state->meas_err_avg = 0;
+	state->meas_err_rate = 0;
+}
+
+void awdl_sync_meas_err(struct awdl_sync_state *state, int64_t err_tu) {
+	uint64_t err = ieee80211_tu_to_usec(err_tu < 0 ? -err_tu : err_tu);
+	uint64_t eaw_period = ieee80211_tu_to_usec(state->presence_mode * state->aw_period);
+
+	if (err > eaw_period) /* do not let the initial synchronization dominate the average */
+		err = eaw_period;
+	state->meas_err_avg = (7 * (uint64_t) state->meas_err_avg + err) / 8;
+	/* recent errors only, so that we react to a new burst but also recover from the initial synchronization */
+	state->meas_err_rate -= state->meas_err_rate / AWDL_SYNC_ERR_RATE_DIV;
+	if (err_tu > AWDL_SYNC_THRESHOLD || err_tu < -AWDL_SYNC_THRESHOLD)
+		state->meas_err_rate += AWDL_SYNC_ERR_RATE_ONE / AWDL_SYNC_ERR_RATE_DIV;
+}
+
+/* Master time elapsed since last_update in us */
+static uint64_t awdl_sync_elapsed(uint64_t now_usec, const struct awdl_sync_state *state) {
+	int64_t dt = (int64_t) (now_usec - state->last_update);
+	return (uint64_t) (dt + dt * state->freq_ppb / 1000000000);
+}
+
+/* Convert a master duration to our clock */
+static uint64_t awdl_sync_to_local(uint64_t master_usec, const struct awdl_sync_state *state) {
+	return master_usec - (int64_t) master_usec * state->freq_ppb / 1000000000;
 }
 
 uint16_t awdl_sync_next_aw_tu(uint64_t now_usec, const struct awdl_sync_state *state) {
 	uint64_t eaw_period = state->presence_mode * state->aw_period;
-	uint64_t time_since = ieee80211_usec_to_tu(now_usec - state->last_update);
+	uint64_t time_since = ieee80211_usec_to_tu(awdl_sync_elapsed(now_usec, state));
 	uint64_t next_aw_tu = eaw_period - (time_since % eaw_period);
 	return (uint16_t) next_aw_tu;
 }
 
 uint64_t awdl_sync_next_aw_us(uint64_t now_usec, const struct awdl_sync_state *state) {
 	uint64_t eaw_period = ieee80211_tu_to_usec(state->presence_mode * state->aw_period);
-	uint64_t time_since = now_usec - state->last_update;
+	uint64_t time_since = awdl_sync_elapsed(now_usec, state);
 	uint64_t next_aw_us = eaw_period - (time_since % eaw_period);
-	return next_aw_us;
+	return awdl_sync_to_local(next_aw_us, state);
 }
 
 uint16_t awdl_sync_current_aw(uint64_t now_usec, const struct awdl_sync_state *state) {
 	uint64_t eaw_period = state->presence_mode * state->aw_period;
-	uint64_t time_since = ieee80211_usec_to_tu(now_usec - state->last_update);
+	uint64_t time_since = ieee80211_usec_to_tu(awdl_sync_elapsed(now_usec, state));
 	uint64_t current_aw = state->aw_counter + /* last counter */
 	                      (time_since % eaw_period) / state->aw_period + /* within EAW */
 	                      state->presence_mode * (time_since / eaw_period); /* correction for EAWs */
@@ -67,6 +107,103 @@ int64_t awdl_sync_error_tu(uint64_t now_usec, uint16_t time_to_next_aw, uint16_t
 void awdl_sync_update_last(uint64_t now_usec, uint16_t time_to_next_aw, uint16_t aw_counter,
                            struct awdl_sync_state *state) {
 	uint64_t eaw_period = state->presence_mode * state->aw_period;
-	state->last_update = now_usec - ieee80211_tu_to_usec(eaw_period - time_to_next_aw);
+	/* master's value is rounded up to TU (see awdl_sync_next_aw_tu), assume we are in the middle of it */
+	state->last_update = now_usec - ieee80211_tu_to_usec(eaw_period - time_to_next_aw) - 512;
 	state->aw_counter = aw_counter & 0xfffc; /* mask last two bits, effectively 'aw_counter/4*4' */
 }
+
+int64_t awdl_sync_error_us(uint64_t now_usec, uint16_t time_to_next_aw, uint16_t aw_counter,
+                           const struct awdl_sync_state *state) {
+	return ((aw_counter / state->presence_mode - awdl_sync_current_eaw(now_usec, state)) *
+	        (int64_t) ieee80211_tu_to_usec(state->presence_mode * state->aw_period)) -
+	       ((int64_t) ieee80211_tu_to_usec(time_to_next_aw) - 512 - (int64_t) awdl_sync_next_aw_us(now_usec, state));
+}
+
+/* Move last_update to the most recent predicted EAW boundary, so that frequency changes only affect the future */
+static void awdl_sync_reanchor(uint64_t now_usec, struct awdl_sync_state *state) {
+	uint64_t eaw_period = ieee80211_tu_to_usec(state->presence_mode * state->aw_period);
+	uint64_t elapsed;
+
+	if ((int64_t) (now_usec - state->last_update) < 0)
+		return;
+	elapsed = awdl_sync_elapsed(now_usec, state);
+	state->last_update = now_usec - awdl_sync_to_local(elapsed % eaw_period, state);
+	state->aw_counter += (elapsed / eaw_period) * state->presence_mode;
+}
+
+void awdl_sync_update(uint64_t now_usec, uint16_t time_to_next_aw, uint16_t aw_counter,
+                      const struct ether_addr *master, struct awdl_sync_state *state) {
+	int64_t err_tu = awdl_sync_error_tu(now_usec, time_to_next_aw, aw_counter, state);
+	int64_t err_us = awdl_sync_error_us(now_usec, time_to_next_aw, aw_counter, state);
+	int64_t interval = now_usec - state->last_sync;
+	int64_t freq;
+
+	state->last_sync = now_usec;
+
+	if (!state->locked || memcmp(&state->master, master, sizeof(struct ether_addr))) {
+		/* new master: start from scratch */
+		state->master = *master;
+		state->locked = 1;
+		state->freq_ppb = 0;
+		awdl_sync_update_last(now_usec, time_to_next_aw, aw_counter, state);
+		return;
+	}
+	if (err_tu > AWDL_SYNC_THRESHOLD || err_tu < -AWDL_SYNC_THRESHOLD || interval <= 0) {
+		awdl_sync_update_last(now_usec, time_to_next_aw, aw_counter, state);
+		return;
+	}
+
+	awdl_sync_reanchor(now_usec, state);
+
+	/* P: slew part of the phase error, the master being ahead (err > 0) means earlier boundaries */
+	state->last_update -= err_us / AWDL_SYNC_KP_DIV;
+	if ((int64_t) (now_usec - state->last_update) < 0) {
+		state->last_update -= awdl_sync_to_local(ieee80211_tu_to_usec(state->presence_mode * state->aw_period), state);
+		state->aw_counter -= state->presence_mode;
+	}
+
+	/* I: accumulate the remaining error as frequency offset */
+	freq = state->freq_ppb + err_us * 1000000000 / interval / AWDL_SYNC_KI_DIV;
+	if (freq > AWDL_SYNC_FREQ_MAX_PPB)
+		freq = AWDL_SYNC_FREQ_MAX_PPB;
+	else if (freq < -AWDL_SYNC_FREQ_MAX_PPB)
+		freq = -AWDL_SYNC_FREQ_MAX_PPB;
+	state->freq_ppb = freq;
+}
+
+int awdl_sync_is_holdover(uint64_t now_usec, const struct awdl_sync_state *state) {
+	return state->locked && now_usec - state->last_sync > AWDL_SYNC_HOLDOVER_US;
+}
+
+uint64_t awdl_sync_tsf_to_local(struct awdl_sync_state *state, uint64_t tsf, uint64_t now_usec) {
+	int64_t offset = (int64_t) (now_usec - tsf);
+	int64_t drift;
+	uint64_t local;
+
+	if (!state->tsf_valid || offset < state->tsf_offset || offset - state->tsf_offset > AWDL_SYNC_TSF_MAX_DELAY) {
+		/* least delayed frame so far, or TSF was reset */
+		state->tsf_offset = offset;
+		state->tsf_valid = 1;
+		state->tsf_last = now_usec;
+	} else {
+		/* the minimum may only grow as fast as both clocks can drift apart, so that delays do not count */
+		drift = (int64_t) ((now_usec - state->tsf_last) * AWDL_SYNC_FREQ_MAX_PPB / 1000000000);
+		if (drift > 0) {
+			state->tsf_offset += offset - state->tsf_offset < drift ? offset - state->tsf_offset : drift;
+			state->tsf_last = now_usec;
+		}
+	}
+
+	local = tsf + state->tsf_offset;
+	return local > now_usec ? now_usec : local;
+}
+
+void awdl_sync_tx_delay_update(struct awdl_sync_state *state, uint64_t delay) {
+	if (delay > AWDL_SYNC_TX_DELAY_MAX)
+		return; /* frame was held back, e.g., during a channel switch */
+	if (!state->tx_delay_samples)
+		state->tx_delay = delay;
+	else
+		state->tx_delay = (7 * (uint64_t) state->tx_delay + delay) / 8;
+	state->tx_delay_samples++;
+}
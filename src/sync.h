@@ -21,6 +21,24 @@
 #define AWDL_SYNC_H_
 
 #include <stdint.h>
+#include <net/ethernet.h>
+
+/* Larger errors (in TU) are corrected by a step instead of slewing */
+#define AWDL_SYNC_THRESHOLD 3
+/* PI loop gains (1/x), critically damped and slow enough to average out the 1 TU resolution of the master's values */
+#define AWDL_SYNC_KP_DIV 16
+#define AWDL_SYNC_KI_DIV 1024
+/* Maximum frequency offset to the master, two 100 ppm clocks */
+#define AWDL_SYNC_FREQ_MAX_PPB 200000
+/* Without updates for this long, we run on the estimated frequency only */
+#define AWDL_SYNC_HOLDOVER_US 1000000
+/* Own frames that took longer (in us) to reach the air are not used for the TX delay estimate */
+#define AWDL_SYNC_TX_DELAY_MAX 20000
+/* A TSF that appears delayed by more than this (in us) was reset, e.g., after a channel switch */
+#define AWDL_SYNC_TSF_MAX_DELAY 100000
+/* Fixed-point one of the sync error rate and weight (1/x) of a new measurement in it */
+#define AWDL_SYNC_ERR_RATE_ONE 65536
+#define AWDL_SYNC_ERR_RATE_DIV 16
 
 struct awdl_sync_state {
 	uint16_t aw_counter;
@@ -28,9 +46,26 @@ struct awdl_sync_state {
 	uint16_t aw_period; /* in TU */
 	uint8_t presence_mode;
 
+	/* drift estimation, see awdl_sync_update() */
+	struct ether_addr master; /* the clock we are following */
+	uint8_t locked;
+	int32_t freq_ppb; /* master clock runs this much faster than ours */
+	uint64_t last_sync; /* time of last sync update in us */
+
+	/* mapping of the radio's TSF onto our clock, see awdl_sync_tsf_to_local() */
+	int64_t tsf_offset; /* local time minus TSF in us */
+	uint8_t tsf_valid;
+	uint64_t tsf_last; /* when tsf_offset was last changed, in us */
+
+	/* delay from building an action frame until it is on air, see awdl_sync_tx_delay_update() */
+	uint32_t tx_delay; /* smoothed, in us */
+	uint32_t tx_delay_samples;
+
 	/* statistics */
 	uint64_t meas_err;
 	uint64_t meas_total;
+	uint32_t meas_err_avg; /* smoothed absolute sync error in us */
+	uint32_t meas_err_rate; /* smoothed share of errors beyond AWDL_SYNC_THRESHOLD, in 1/AWDL_SYNC_ERR_RATE_ONE */
 };
 
 void awdl_sync_state_init(struct awdl_sync_state *state, uint64_t now);
@@ -46,7 +81,44 @@ uint16_t awdl_sync_current_eaw(uint64_t now_usec, const struct awdl_sync_state *
 int64_t awdl_sync_error_tu(uint64_t now_usec, uint16_t time_to_next_aw, uint16_t aw_counter,
                            const struct awdl_sync_state *state);
 
+/* Like awdl_sync_error_tu() but in us, assuming that the sender's value lies in the middle of the TU */
+int64_t awdl_sync_error_us(uint64_t now_usec, uint16_t time_to_next_aw, uint16_t aw_counter,
+                           const struct awdl_sync_state *state);
+
+/* Record a measured sync error in the smoothed average and error rate */
+void awdl_sync_meas_err(struct awdl_sync_state *state, int64_t err_tu);
+
+/* Step to the master's timing without adjusting the frequency estimate */
 void awdl_sync_update_last(uint64_t now_usec, uint16_t time_to_next_aw, uint16_t aw_counter,
                            struct awdl_sync_state *state);
 
+/**
+ * Follow the master's timing with a PI loop: small errors are slewed and used to estimate the
+ * frequency offset, large errors and new masters cause a step. Between updates, the estimated
+ * frequency is used to predict the master's AW boundaries.
+ */
+void awdl_sync_update(uint64_t now_usec, uint16_t time_to_next_aw, uint16_t aw_counter,
+                      const struct ether_addr *master, struct awdl_sync_state *state);
+
+/**
+ * Map a receive timestamp of the radio's TSF (e.g., from radiotap) onto our clock.
+ * The offset between both clocks is tracked with a minimum filter over all frames,
+ * since each {@code now} also includes the variable delay until the frame reached us.
+ * To follow drift, the minimum may grow by at most AWDL_SYNC_FREQ_MAX_PPB of the elapsed time.
+ * @param tsf the TSF timestamp in us
+ * @param now_usec the time at which the frame was received on our clock
+ * @return the time at which the frame was received by the radio, at most {@code now_usec}
+ */
+uint64_t awdl_sync_tsf_to_local(struct awdl_sync_state *state, uint64_t tsf, uint64_t now_usec);
+
+/**
+ * Record the time it took one of our frames to reach the air, e.g., measured from
+ * its echo on the monitor interface. The timing fields we advertise are advanced by
+ * the smoothed {@code tx_delay}, see awdl_update_sync_params_tlv().
+ */
+void awdl_sync_tx_delay_update(struct awdl_sync_state *state, uint64_t delay);
+
+/* Whether we have not heard from the master for some time and only rely on the estimated frequency */
+int awdl_sync_is_holdover(uint64_t now_usec, const struct awdl_sync_state *state);
+
 #endif /* AWDL_SYNC_H_ */
@@ -37,11 +37,11 @@
 #define AWDL_SOCIAL_CHANNEL_44_BIT  0x0002
 #define AWDL_SOCIAL_CHANNEL_149_BIT 0x0004
 
-int awdl_init_data(uint8_t *buf, struct awdl_state *state) {
+static int awdl_init_data_seq(uint8_t *buf, uint16_t seq) {
 	struct awdl_data *header = (struct awdl_data *) buf;
 
 	header->head = htole16(AWDL_DATA_HEAD);
-	header->seq = htole16(awdl_state_next_sequence_number(state));
+	header->seq = htole16(seq);
 	header->pad = htole16(AWDL_DATA_PAD);
 	/* TODO we should generally to able to send any kind of data */
 	header->ethertype = htobe16(ETH_P_IPV6);
@@ -49,18 +49,21 @@ int awdl_init_data(uint8_t *buf, struct awdl_state *state) {
 	return sizeof(struct awdl_data);
 }
 
-int awdl_init_action(uint8_t *buf, enum awdl_action_type type) {
+int awdl_init_data(uint8_t *buf, struct awdl_state *state) {
+	return awdl_init_data_seq(buf, awdl_state_next_sequence_number(state));
+}
+
+int awdl_init_action(uint8_t *buf, enum awdl_action_type type, uint64_t now) {
 	struct awdl_action *af = (struct awdl_action *) buf;
 
-	uint32_t steady_time = (uint32_t) clock_time_us(); /* TODO awdl_init_* methods should not call clock_time_us() themselves but rather be given as parameter to avoid inconsistent calculation of stuff, e.g., fields in sync parameters should be calculated based on the timestamp indicated in af->target_tx */
 	af->category = IEEE80211_VENDOR_SPECIFIC; /* vendor specific */
 	af->oui = AWDL_OUI;
 	af->type = AWDL_TYPE;
 	af->version = AWDL_VERSION_COMPAT;
 	af->subtype = type;
 	af->reserved = 0;
-	af->phy_tx = htole32(steady_time); /* TODO arbitrary offset */
-	af->target_tx = htole32(steady_time);
+	af->phy_tx = htole32((uint32_t) now); /* TODO arbitrary offset */
+	af->target_tx = htole32((uint32_t) now); /* also used to measure our TX delay, see awdl_rx() */
 
 	return sizeof(struct awdl_action);
 }
@@ -95,12 +98,9 @@ int awdl_init_chanseq(uint8_t *buf, const struct awdl_state *state) {
 	return offset;
 }
 
-int awdl_init_sync_params_tlv(uint8_t *buf, const struct awdl_state *state) {
+int awdl_init_sync_params_tlv(uint8_t *buf, const struct awdl_state *state, uint64_t now) {
 	struct awdl_sync_params_tlv *tlv = (struct awdl_sync_params_tlv *) buf;
 	int len;
-	uint64_t now;
-
-	now = clock_time_us();
 
 	tlv->type = AWDL_SYNCHRONIZATON_PARAMETERS_TLV;
 
@@ -118,22 +118,12 @@ int awdl_init_sync_params_tlv(uint8_t *buf, const struct awdl_state *state) {
 
 	tlv->reserved = 0;
 
-	/* TODO: dynamic info needs to be adjusted during runtime */
-	tlv->next_aw_channel = awdl_chan_num(state->channel.current,
-	                                     state->channel.enc); /* TODO need to calculate this from current seq */
-	tlv->next_aw_seq = htole16(awdl_sync_current_aw(now, &state->sync));
-	tlv->ap_alignment = tlv->next_aw_seq; /* awdl_fill_sync_params(..) */
-	tlv->tx_down_counter = htole16(awdl_sync_next_aw_tu(now, &state->sync));
 	tlv->af_period = htole16(state->psf_interval);
 	tlv->presence_mode = state->sync.presence_mode; /* always available, usually 4 */
 	tlv->master_addr = state->election.master_addr;
 	tlv->master_channel = awdl_chan_num(state->channel.master, state->channel.enc);
-	/* lower bound is 0 */
-	if (le16toh(tlv->aw_com_length) < (le16toh(tlv->aw_period) * tlv->presence_mode - le16toh(tlv->tx_down_counter)))
-		tlv->remaining_aw_length = htole16(0);
-	else
-		tlv->remaining_aw_length = htole16(le16toh(tlv->aw_com_length) -
-		                                   (le16toh(tlv->aw_period) * tlv->presence_mode - le16toh(tlv->tx_down_counter)));
+
+	awdl_update_sync_params_tlv(tlv, state, now);
 
 	len = sizeof(struct awdl_sync_params_tlv);
 	len += awdl_init_chanseq(buf + sizeof(struct awdl_sync_params_tlv), state);
@@ -146,6 +136,24 @@ int awdl_init_sync_params_tlv(uint8_t *buf, const struct awdl_state *state) {
 	return len;
 }
 
+void awdl_update_sync_params_tlv(struct awdl_sync_params_tlv *tlv, const struct awdl_state *state, uint64_t now) {
+	/* describe our timing at the moment the frame is on air, not when it is built */
+	now += state->sync.tx_delay;
+
+	/* TODO: dynamic info needs to be adjusted during runtime */
+	tlv->next_aw_channel = awdl_chan_num(state->channel.current,
+	                                     state->channel.enc); /* TODO need to calculate this from current seq */
+	tlv->next_aw_seq = htole16(awdl_sync_current_aw(now, &state->sync));
+	tlv->ap_alignment = tlv->next_aw_seq; /* awdl_fill_sync_params(..) */
+	tlv->tx_down_counter = htole16(awdl_sync_next_aw_tu(now, &state->sync));
+	/* lower bound is 0 */
+	if (le16toh(tlv->aw_com_length) < (le16toh(tlv->aw_period) * tlv->presence_mode - le16toh(tlv->tx_down_counter)))
+		tlv->remaining_aw_length = htole16(0);
+	else
+		tlv->remaining_aw_length = htole16(le16toh(tlv->aw_com_length) -
+		                                   (le16toh(tlv->aw_period) * tlv->presence_mode - le16toh(tlv->tx_down_counter)));
+}
+
 int awdl_init_chanseq_tlv(uint8_t *buf, const struct awdl_state *state) {
 	struct awdl_chanseq_tlv *tlv = (struct awdl_chanseq_tlv *) buf;
 	int len;
@@ -318,8 +326,8 @@ int ieee80211_init_radiotap_header(uint8_t *buf) {
 	return ptr - buf;
 }
 
-int ieee80211_init_awdl_hdr(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst,
-                            struct ieee80211_state *state, uint16_t type) {
+static int ieee80211_init_awdl_hdr_seq(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst,
+                                      uint16_t type, uint16_t seq_ctrl) {
 	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *) buf;
 
 	hdr->frame_control = htole16(type);
@@ -327,11 +335,16 @@ int ieee80211_init_awdl_hdr(uint8_t *buf, const struct ether_addr *src, const st
 	hdr->addr1 = *dst;
 	hdr->addr2 = *src;
 	hdr->addr3 = AWDL_BSSID;
-	hdr->seq_ctrl = htole16(ieee80211_state_next_sequence_number(state) << 4);
+	hdr->seq_ctrl = htole16(seq_ctrl);
 
 	return sizeof(struct ieee80211_hdr);
 }
 
+int ieee80211_init_awdl_hdr(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst,
+                            struct ieee80211_state *state, uint16_t type) {
+	return ieee80211_init_awdl_hdr_seq(buf, src, dst, type, ieee80211_state_next_sequence_number(state) << 4);
+}
+
 int ieee80211_init_awdl_action_hdr(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst,
                                    struct ieee80211_state *state) {
 	return ieee80211_init_awdl_hdr(buf, src, dst, state, IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_ACTION);
@@ -361,13 +374,13 @@ int ieee80211_add_fcs(const uint8_t *start, uint8_t *end) {
 }
 
 int awdl_init_full_action_frame(uint8_t *buf, struct awdl_state *state, struct ieee80211_state *ieee80211_state,
-                                enum awdl_action_type type) {
+                                enum awdl_action_type type, uint64_t now) {
 	uint8_t *ptr = buf;
 
 	ptr += ieee80211_init_radiotap_header(ptr);
 	ptr += ieee80211_init_awdl_action_hdr(ptr, &state->self_address, &state->dst, ieee80211_state);
-	ptr += awdl_init_action(ptr, type);
-	ptr += awdl_init_sync_params_tlv(ptr, state);
+	ptr += awdl_init_action(ptr, type, now);
+	ptr += awdl_init_sync_params_tlv(ptr, state, now);
 	ptr += awdl_init_election_params_tlv(ptr, state);
 	ptr += awdl_init_chanseq_tlv(ptr, state);
 	ptr += awdl_init_election_params_v2_tlv(ptr, state);
@@ -384,6 +397,151 @@ int awdl_init_full_action_frame(uint8_t *buf, struct awdl_state *state, struct i
 	return ptr - buf;
 }
 
+void awdl_action_template_init(struct awdl_action_template *tmpl, enum awdl_action_type type) {
+	memset(&tmpl->key, 0, sizeof(tmpl->key));
+	tmpl->type = type;
+	tmpl->len = 0;
+	tmpl->hdr_offset = 0;
+	tmpl->action_offset = 0;
+	tmpl->sync_params_offset = 0;
+}
+
+static void awdl_action_template_key_init(struct awdl_action_template_key *key, const struct awdl_state *state,
+                                          const struct ieee80211_state *ieee80211_state) {
+	memset(key, 0, sizeof(*key)); /* padding is compared as well */
+	strncpy(key->name, state->name, HOST_NAME_LENGTH_MAX);
+	key->self_address = state->self_address;
+	key->dst = state->dst;
+	key->version = state->version;
+	key->dev_class = state->dev_class;
+	key->psf_interval = state->psf_interval;
+	key->aw_period = state->sync.aw_period;
+	key->presence_mode = state->sync.presence_mode;
+	key->election = state->election;
+	key->enc = state->channel.enc;
+	key->master = state->channel.master;
+	memcpy(key->sequence, state->channel.sequence, sizeof(key->sequence));
+	key->fcs = ieee80211_state->fcs;
+}
+
+int awdl_action_template_update(struct awdl_action_template *tmpl, struct awdl_state *state,
+                                struct ieee80211_state *ieee80211_state, uint64_t now) {
+	struct awdl_action_template_key key;
+	struct ieee80211_hdr *hdr;
+	struct awdl_action *af;
+
+	awdl_action_template_key_init(&key, state, ieee80211_state);
+
+	if (!tmpl->len || memcmp(&key, &tmpl->key, sizeof(key))) {
+		/* rebuild, also assigns a new sequence number */
+		tmpl->len = awdl_init_full_action_frame(tmpl->buf, state, ieee80211_state, tmpl->type, now);
+		tmpl->key = key;
+		tmpl->hdr_offset = le16toh(((struct ieee80211_radiotap_header *) tmpl->buf)->it_len);
+		tmpl->action_offset = tmpl->hdr_offset + sizeof(struct ieee80211_hdr);
+		tmpl->sync_params_offset = tmpl->action_offset + sizeof(struct awdl_action);
+	} else {
+		hdr = (struct ieee80211_hdr *) (tmpl->buf + tmpl->hdr_offset);
+		hdr->seq_ctrl = htole16(ieee80211_state_next_sequence_number(ieee80211_state) << 4);
+	}
+
+	af = (struct awdl_action *) (tmpl->buf + tmpl->action_offset);
+	af->phy_tx = htole32((uint32_t) now);
+	af->target_tx = htole32((uint32_t) now);
+	awdl_update_sync_params_tlv((struct awdl_sync_params_tlv *) (tmpl->buf + tmpl->sync_params_offset), state, now);
+
+	if (ieee80211_state->fcs)
+		ieee80211_add_fcs(tmpl->buf, tmpl->buf + tmpl->len - sizeof(uint32_t));
+
+	return tmpl->len;
+}
+
+int awdl_init_data_hdr(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst) {
+	uint8_t *ptr = buf;
+
+	/* sequence numbers are set per frame, see awdl_encap_data() */
+	ptr += ieee80211_init_radiotap_header(ptr);
+	ptr += ieee80211_init_awdl_hdr_seq(ptr, src, dst, IEEE80211_FTYPE_DATA | IEEE80211_STYPE_DATA, 0);
+	ptr += llc_init_awdl_hdr(ptr);
+	ptr += awdl_init_data_seq(ptr, 0);
+
+	return ptr - buf;
+}
+
+int awdl_data_hdr_matches(const uint8_t *hdr, int hdr_len, const struct ether_addr *src, const struct ether_addr *dst) {
+	const struct ieee80211_hdr *ieee80211;
+	if (hdr_len <= 0)
+		return 0;
+	ieee80211 = (const struct ieee80211_hdr *) (hdr + le16toh(((const struct ieee80211_radiotap_header *) hdr)->it_len));
+	return !memcmp(&ieee80211->addr1, dst, sizeof(struct ether_addr)) &&
+	       !memcmp(&ieee80211->addr2, src, sizeof(struct ether_addr));
+}
+
+int awdl_encap_data(struct buf *frame, const uint8_t *hdr, int hdr_len,
+                    struct awdl_state *state, struct ieee80211_state *ieee80211_state) {
+	uint8_t *ptr, *fcs;
+	struct ieee80211_hdr *ieee80211;
+	struct awdl_data *data;
+
+	BUF_STRIP(frame, ETHER_HDR_LEN);
+	ptr = buf_push(frame, hdr_len);
+	if (!ptr)
+		return TX_FAIL;
+	memcpy(ptr, hdr, hdr_len);
+
+	ieee80211 = (struct ieee80211_hdr *) (ptr + le16toh(((const struct ieee80211_radiotap_header *) ptr)->it_len));
+	ieee80211->seq_ctrl = htole16(ieee80211_state_next_sequence_number(ieee80211_state) << 4);
+	data = (struct awdl_data *) (ptr + hdr_len - sizeof(struct awdl_data));
+	data->seq = htole16(awdl_state_next_sequence_number(state));
+
+	if (ieee80211_state->fcs) {
+		fcs = buf_put(frame, sizeof(uint32_t));
+		if (!fcs)
+			return TX_FAIL;
+		ieee80211_add_fcs(buf_data(frame), fcs);
+	}
+
+	return TX_OK;
+wire_error:
+	return TX_FAIL;
+}
+
+int awdl_amsdu_subframe_len(int len) {
+	return len + sizeof(struct llc_hdr) + sizeof(struct awdl_data); /* Ethernet header is replaced by subframe header */
+}
+
+int awdl_init_full_amsdu_frame(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst,
+                               const struct buf *const *frames, int num,
+                               struct awdl_state *state, struct ieee80211_state *ieee80211_state) {
+	uint8_t *ptr = buf, *body;
+
+	ptr += ieee80211_init_radiotap_header(ptr);
+	ptr += ieee80211_init_awdl_hdr(ptr, src, dst, ieee80211_state, IEEE80211_FTYPE_DATA | IEEE80211_STYPE_QOS_DATA);
+	*(uint16_t *) ptr = htole16(IEEE80211_QOS_CTL_A_MSDU_PRESENT);
+	ptr += IEEE80211_QOS_CTL_LEN;
+
+	body = ptr;
+	for (int i = 0; i < num; i++) {
+		int plen = buf_len(frames[i]) - ETHER_HDR_LEN;
+		if (plen < 0)
+			continue;
+		while ((ptr - body) % 4) /* padding */
+			*ptr++ = 0;
+		memcpy(ptr, buf_data(frames[i]), 2 * ETHER_ADDR_LEN); /* DA and SA */
+		ptr += 2 * ETHER_ADDR_LEN;
+		*(uint16_t *) ptr = htobe16(awdl_amsdu_subframe_len(plen));
+		ptr += sizeof(uint16_t);
+		ptr += llc_init_awdl_hdr(ptr);
+		ptr += awdl_init_data(ptr, state);
+		memcpy(ptr, buf_data(frames[i]) + ETHER_HDR_LEN, plen);
+		ptr += plen;
+	}
+
+	if (ieee80211_state->fcs)
+		ptr += ieee80211_add_fcs(buf, ptr);
+
+	return ptr - buf;
+}
+
 int awdl_init_full_data_frame(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst,
                               const uint8_t *payload, unsigned int plen,
                               struct awdl_state *state, struct ieee80211_state *ieee80211_state) {
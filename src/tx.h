@@ -29,11 +29,51 @@ enum TX_RESULT {
 	TX_FAIL = -1,
 };
 
-int awdl_init_action(uint8_t *buf, enum awdl_action_type);
+/* Reserved space in TX buffers read from the host to encapsulate Ethernet frames in place */
+#define AWDL_DATA_HEADROOM (AWDL_DATA_HDR_MAX_LEN - ETHER_HDR_LEN)
+#define AWDL_DATA_TAILROOM 4 /* FCS */
+
+#define AWDL_AMSDU_MAX_LEN 7935 /* HT maximum */
+#define AWDL_AMSDU_DEFAULT_LEN 2304 /* maximum MSDU size for non-HT rates */
+
+#define AWDL_ACTION_TEMPLATE_MAX_LEN 1024
+
+/* State that the static part of an action frame is built from */
+struct awdl_action_template_key {
+	char name[HOST_NAME_LENGTH_MAX + 1];
+	struct ether_addr self_address;
+	struct ether_addr dst;
+	uint8_t version;
+	uint8_t dev_class;
+	uint16_t psf_interval;
+	uint16_t aw_period;
+	uint8_t presence_mode;
+	struct awdl_election_state election;
+	enum awdl_chan_encoding enc;
+	struct awdl_chan master;
+	struct awdl_chan sequence[AWDL_CHANSEQ_LENGTH];
+	bool fcs;
+};
+
+/* Prebuilt action frame, only time-dependent fields are updated before sending */
+struct awdl_action_template {
+	enum awdl_action_type type;
+	struct awdl_action_template_key key;
+	uint8_t buf[AWDL_ACTION_TEMPLATE_MAX_LEN];
+	int len; /* 0 if not built yet */
+	int hdr_offset;
+	int action_offset;
+	int sync_params_offset;
+};
+
+int awdl_init_action(uint8_t *buf, enum awdl_action_type, uint64_t now);
 
 int awdl_init_chanseq(uint8_t *buf, const struct awdl_state *);
 
-int awdl_init_sync_params_tlv(uint8_t *buf, const struct awdl_state *);
+int awdl_init_sync_params_tlv(uint8_t *buf, const struct awdl_state *, uint64_t now);
+
+/* Set the timing fields for a frame built at {@code now}, compensating for the estimated TX delay */
+void awdl_update_sync_params_tlv(struct awdl_sync_params_tlv *tlv, const struct awdl_state *, uint64_t now);
 
 int awdl_init_chanseq_tlv(uint8_t *buf, const struct awdl_state *);
 
@@ -51,10 +91,65 @@ int awdl_init_arpa_tlv(uint8_t *buf, const struct awdl_state *);
 
 int awdl_init_version_tlv(uint8_t *buf, const struct awdl_state *);
 
-int awdl_init_full_action_frame(uint8_t *buf, struct awdl_state *, struct ieee80211_state *, enum awdl_action_type);
+/* Build a complete action frame, all time-dependent fields are derived from {@code now} */
+int awdl_init_full_action_frame(uint8_t *buf, struct awdl_state *, struct ieee80211_state *, enum awdl_action_type,
+                                uint64_t now);
+
+void awdl_action_template_init(struct awdl_action_template *tmpl, enum awdl_action_type type);
+
+/** @brief Get action frame ready to send.
+ *
+ * Rebuilds the frame only if any state it depends on changed. Otherwise, only
+ * the sequence number, the TX timestamps, the dynamic sync parameters, and the FCS
+ * are updated in place.
+ *
+ * @param tmpl template of which {@code tmpl->buf} holds the frame after return
+ * @param now current time, used for all time-dependent fields
+ * @return length of the frame
+ */
+int awdl_action_template_update(struct awdl_action_template *tmpl, struct awdl_state *,
+                                struct ieee80211_state *, uint64_t now);
 
 int awdl_init_data(uint8_t *buf, struct awdl_state *);
 
+/** @brief Initialize all headers of a data frame from {@code src} to {@code dst}.
+ *
+ * Sequence numbers are left empty and set per frame by {@code awdl_encap_data}.
+ *
+ * @param buf of at least {@code AWDL_DATA_HDR_MAX_LEN} bytes
+ * @return length of the headers
+ */
+int awdl_init_data_hdr(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst);
+
+/** @brief Whether headers built by {@code awdl_init_data_hdr} are for {@code src} and {@code dst}. */
+int awdl_data_hdr_matches(const uint8_t *hdr, int hdr_len, const struct ether_addr *src, const struct ether_addr *dst);
+
+/** @brief Convert Ethernet frame to AWDL data frame in place.
+ *
+ * Replaces the Ethernet header of {@code frame} with the headers built by {@code awdl_init_data_hdr}
+ * and appends the FCS if required. The payload is not copied.
+ *
+ * @return TX_OK or TX_FAIL if {@code frame} is too short or has not enough head- or tailroom
+ */
+int awdl_encap_data(struct buf *frame, const uint8_t *hdr, int hdr_len,
+                    struct awdl_state *, struct ieee80211_state *);
+
+/** @brief Length of an A-MSDU subframe (without padding) that carries an Ethernet frame of {@code len} bytes. */
+int awdl_amsdu_subframe_len(int len);
+
+/** @brief Initialize A-MSDU data frame from {@code src} to {@code dst} carrying Ethernet frames.
+ *
+ * Each Ethernet frame is converted to an A-MSDU subframe with its own LLC and AWDL data header.
+ * Subframe addresses are taken from the respective Ethernet header.
+ *
+ * @param frames Ethernet frames to aggregate
+ * @param num number of frames
+ * @return length of the frame
+ */
+int awdl_init_full_amsdu_frame(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst,
+                               const struct buf *const *frames, int num,
+                               struct awdl_state *, struct ieee80211_state *);
+
 int awdl_init_full_data_frame(uint8_t *buf, const struct ether_addr *src, const struct ether_addr *dst,
                               const uint8_t *payload, unsigned int plen,
                               struct awdl_state *, struct ieee80211_state *);
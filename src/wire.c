@@ -22,19 +22,17 @@
 
 #include "wire.h"
 
-struct buf {
-	const uint8_t *orig;
-	uint8_t *data;
-	int len;
-	int owned;
-};
-
 struct buf *buf_new_owned(int len) {
-	if (len < 0)
+	return buf_new_owned_reserve(0, len, 0);
+}
+
+struct buf *buf_new_owned_reserve(int headroom, int len, int tailroom) {
+	if (headroom < 0 || len < 0 || tailroom < 0)
 		return NULL;
 	struct buf *buf = (struct buf *) malloc(sizeof(struct buf));
-	buf->data = (uint8_t *) malloc(len);
-	buf->orig = buf->data;
+	buf->size = headroom + len + tailroom;
+	buf->orig = (uint8_t *) malloc(buf->size);
+	buf->data = (uint8_t *) buf->orig + headroom;
 	buf->len = len;
 	buf->owned = 1;
 	return buf;
@@ -47,6 +45,18 @@ const struct buf *buf_new_const(const uint8_t *data, int len) {
 	buf->data = (uint8_t *) data;
 	buf->orig = data;
 	buf->len = len;
+	buf->size = len;
+	buf->owned = 0;
+	return buf;
+}
+
+const struct buf *buf_init_const(struct buf *buf, const uint8_t *data, int len) {
+	if (len < 0)
+		return NULL;
+	buf->data = (uint8_t *) data;
+	buf->orig = data;
+	buf->len = len;
+	buf->size = len;
 	buf->owned = 0;
 	return buf;
 }
@@ -65,6 +75,29 @@ int buf_len(const struct buf *buf) {
 	return buf->len;
 }
 
+int buf_headroom(const struct buf *buf) {
+	return buf->data - buf->orig;
+}
+
+int buf_tailroom(const struct buf *buf) {
+	return buf->size - buf_headroom(buf) - buf->len;
+}
+
+uint8_t *buf_push(struct buf *buf, int len) {
+	if (len > buf_headroom(buf) || len < 0)
+		return NULL;
+	buf->data -= len;
+	buf->len += len;
+	return buf->data;
+}
+
+uint8_t *buf_put(struct buf *buf, int len) {
+	if (len > buf_tailroom(buf) || len < 0)
+		return NULL;
+	buf->len += len;
+	return buf->data + buf->len - len;
+}
+
 int buf_strip(const struct buf *buf, int len) {
 	if (len > buf->len || len < 0)
 		return OUT_OF_BOUNDS;
@@ -50,15 +50,24 @@
 #endif /* __APPLE__ */
 
 
-/** @brief Opaque buffer used to transport network packets.
+/** @brief Buffer used to transport network packets.
  *
  * We can read from and write to a buffer using dedicated
- * read and write functions.
+ * read and write functions. The members are only exposed so
+ * that views can be placed on the stack and should not be
+ * accessed directly.
  *
  * @see buf_data
  * @see buf_len
+ * @see buf_init_const
  */
-struct buf;
+struct buf {
+	const uint8_t *orig;
+	uint8_t *data;
+	int len;
+	int size; /* of internal array, including head- and tailroom */
+	int owned;
+};
 
 /* TODO change interface: only return wire_error or 0, do not return length */
 
@@ -78,6 +87,21 @@ enum wire_error {
  */
 struct buf *buf_new_owned(int len);
 
+/** @brief Allocates a new {@code buf} with reserved space before and after the data.
+ *
+ * The reserved space allows to add headers and trailers later
+ * without copying the data.
+ *
+ * @param headroom bytes reserved in front of the data
+ * @param len length of the buffer in bytes
+ * @param tailroom bytes reserved behind the data
+ * @return a pointer to a mutable {@code buf} instance
+ *
+ * @see buf_push
+ * @see buf_put
+ */
+struct buf *buf_new_owned_reserve(int headroom, int len, int tailroom);
+
 /** @brief Allocates a new {@code buf} an already existing bytes array.
  *
  * Will use {@code data} as its internal array which is _not_ freed when calling {@code buf_free}.
@@ -91,6 +115,19 @@ struct buf *buf_new_owned(int len);
  */
 const struct buf *buf_new_const(const uint8_t *data, int len);
 
+/** @brief Initializes a view on an already existing bytes array in caller-provided storage.
+ *
+ * Does not allocate, so the returned {@code buf} must _not_ be passed to {@code buf_free}.
+ *
+ * @param buf storage for the view, e.g., on the stack
+ * @param data immutable reference to buffer array
+ * @param len length of the buffer in bytes
+ * @return {@code buf} or NULL if {@code len} is negative
+ *
+ * @see buf_new_const
+ */
+const struct buf *buf_init_const(struct buf *buf, const uint8_t *data, int len);
+
 /** @brief Deallocates a {@code buf} instance.
  *
  * Will dellocate internal bytes array if {@code buf} is an 'owned' instance.
@@ -108,6 +145,24 @@ const uint8_t *buf_data(const struct buf *buf);
 /** @brief Length of internal bytes array. */
 int buf_len(const struct buf *buf);
 
+/** @brief Number of unused bytes in front of the data. */
+int buf_headroom(const struct buf *buf);
+
+/** @brief Number of unused bytes behind the data. */
+int buf_tailroom(const struct buf *buf);
+
+/** @brief Prepend {@code len} bytes to {@code buf} using its headroom.
+ *
+ * @return pointer to the new start of the data or NULL if there is not enough headroom
+ */
+uint8_t *buf_push(struct buf *buf, int len);
+
+/** @brief Append {@code len} bytes to {@code buf} using its tailroom.
+ *
+ * @return pointer to the appended bytes or NULL if there is not enough tailroom
+ */
+uint8_t *buf_put(struct buf *buf, int len);
+
 #define BUF_STRIP(buf, len) \
   do { \
     int result = buf_strip(buf, len); \
@@ -0,0 +1,95 @@
+/*
+ * OWL: an open Apple Wireless Direct Link (AWDL) implementation
+ * Copyright (C) 2018  The Open Wireless Link Project
+ * Copyright (C) 2018  Milan Stute
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro benchmark for the generic hashmap: insert, lookup, and delete churn
+ * Usage: bench_hashmap [number of keys] [rounds]
+ */
+
+extern "C" {
+#include "hashmap.h"
+}
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double ns_per_op(bench_clock::time_point start, size_t ops) {
+	std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+	return elapsed.count() / ops;
+}
+
+int main(int argc, char *argv[]) {
+	size_t num = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+	size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 0) : 10;
+	std::vector<uint64_t> keys(2 * num);
+	map_t map = hashmap_new(sizeof(uint64_t));
+	bench_clock::time_point start;
+	size_t found = 0;
+
+	if (!map || !num)
+		return EXIT_FAILURE;
+
+	for (size_t i = 0; i < keys.size(); i++)
+		keys[i] = (uint64_t) i * 0x9e3779b97f4a7c15ULL;
+
+	start = bench_clock::now();
+	for (size_t i = 0; i < num; i++)
+		hashmap_put(map, &keys[i], &keys[i]);
+	printf("insert: %8.1f ns/op\n", ns_per_op(start, num));
+
+	start = bench_clock::now();
+	for (size_t r = 0; r < rounds; r++)
+		for (size_t i = 0; i < num; i++)
+			found += hashmap_get(map, &keys[i], NULL, 0) == MAP_OK;
+	printf("hit:    %8.1f ns/op\n", ns_per_op(start, rounds * num));
+
+	start = bench_clock::now();
+	for (size_t r = 0; r < rounds; r++)
+		for (size_t i = num; i < 2 * num; i++)
+			found += hashmap_get(map, &keys[i], NULL, 0) == MAP_OK;
+	printf("miss:   %8.1f ns/op\n", ns_per_op(start, rounds * num));
+
+	/* Sliding window: remove the oldest key and insert a new one */
+	start = bench_clock::now();
+	for (size_t r = 0; r < rounds; r++)
+		for (size_t i = 0; i < num; i++) {
+			size_t off = (r % 2) * num;
+			hashmap_get(map, &keys[off + i], NULL, 1);
+			hashmap_put(map, &keys[(off + num + i) % keys.size()], NULL);
+		}
+	printf("churn:  %8.1f ns/op\n", ns_per_op(start, rounds * num));
+
+	/* Drain completely, exercising shrinking */
+	start = bench_clock::now();
+	for (size_t i = 0; i < keys.size(); i++)
+		hashmap_get(map, &keys[i], NULL, 1);
+	printf("drain:  %8.1f ns/op\n", ns_per_op(start, keys.size()));
+
+	hashmap_free(map);
+
+	if (found != rounds * num) {
+		fprintf(stderr, "lookup mismatch: %zu\n", found);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+/*
+ * OWL: an open Apple Wireless Direct Link (AWDL) implementation
+ * Copyright (C) 2018  The Open Wireless Link Project
+ * Copyright (C) 2018  Milan Stute
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro benchmark for parsing action frames (PSF and MIF) of a known peer,
+ * reports time and heap allocations per frame
+ * Usage: bench_rx [rounds]
+ */
+
+extern "C" {
+#include "rx.h"
+#include "tx.h"
+#include "wire.h"
+}
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+/* Linked with -Wl,--wrap for malloc, calloc, and realloc */
+static size_t alloc_count = 0;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	alloc_count++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	alloc_count++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	alloc_count++;
+	return __real_realloc(ptr, size);
+}
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const struct ether_addr SELF = {{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 }};
+static const struct ether_addr PEER = {{ 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }};
+
+static int init_action(uint8_t *buf, const struct awdl_state *state, enum awdl_action_type type) {
+	uint8_t *ptr = buf;
+
+	ptr += awdl_init_action(ptr, type, 0);
+	ptr += awdl_init_sync_params_tlv(ptr, state, 0);
+	ptr += awdl_init_election_params_tlv(ptr, state);
+	ptr += awdl_init_chanseq_tlv(ptr, state);
+	ptr += awdl_init_election_params_v2_tlv(ptr, state);
+	ptr += awdl_init_service_params_tlv(ptr, state);
+	if (type == AWDL_ACTION_MIF) {
+		ptr += awdl_init_ht_capabilities_tlv(ptr, state);
+		ptr += awdl_init_arpa_tlv(ptr, state);
+	}
+	ptr += awdl_init_data_path_state_tlv(ptr, state);
+	ptr += awdl_init_version_tlv(ptr, state);
+
+	return ptr - buf;
+}
+
+static int bench(const char *name, struct awdl_state *self, const uint8_t *frame, int len, size_t rounds) {
+	struct buf view;
+	bench_clock::time_point start;
+	size_t allocs;
+
+	/* the first frame creates the peer */
+	if (awdl_rx_action(buf_init_const(&view, frame, len), 0, 0, &PEER, &SELF, self) != RX_OK)
+		return -1;
+
+	allocs = alloc_count;
+	start = bench_clock::now();
+	for (size_t i = 0; i < rounds; i++) {
+		if (awdl_rx_action(buf_init_const(&view, frame, len), 0, 0, &PEER, &SELF, self) != RX_OK)
+			return -1;
+	}
+	std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+	allocs = alloc_count - allocs;
+
+	printf("%s: %8.1f ns/frame, %.2f allocations/frame\n", name, elapsed.count() / rounds, (double) allocs / rounds);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	static struct awdl_state self, peer;
+	uint8_t psf[1024], mif[1024];
+	int psf_len, mif_len;
+
+	if (!rounds)
+		return EXIT_FAILURE;
+
+	awdl_init_state(&self, "self", &SELF, CHAN_OPCLASS_6, 0);
+	awdl_init_state(&peer, "peer", &PEER, CHAN_OPCLASS_6, 0);
+	self.filter_rssi = 0;
+	self.peers.admit_frames = 1;
+
+	psf_len = init_action(psf, &peer, AWDL_ACTION_PSF);
+	mif_len = init_action(mif, &peer, AWDL_ACTION_MIF);
+
+	if (bench("PSF", &self, psf, psf_len, rounds) < 0 || bench("MIF", &self, mif, mif_len, rounds) < 0)
+		return EXIT_FAILURE;
+
+	awdl_peers_free(self.peers.peers);
+	awdl_peers_free(peer.peers.peers);
+	return EXIT_SUCCESS;
+}
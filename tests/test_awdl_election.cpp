@@ -28,6 +28,7 @@ extern "C" {
 
 TEST_ADDR(0);
 TEST_ADDR(1);
+TEST_ADDR(2);
 
 #define ASSERT_ETHEREQ(val1, val2) ASSERT_FALSE(compare_ether_addr(&val1, &val2))
 #define ASSERT_ETHERNEQ(val1, val2) ASSERT_TRUE(compare_ether_addr(&val1, &val2))
@@ -136,3 +137,56 @@ TEST(awdl_election, elect_cycle) {
 
 	ASSERT_ETHEREQ(s.master_addr, TEST_ADDR0);
 }
+
+TEST(awdl_election, update_incremental) {
+	struct awdl_election_state s;
+	struct awdl_peer_state p;
+	struct awdl_peer *peer0, *peer1;
+	awdl_election_state_init(&s, &TEST_ADDR1);
+	awdl_peer_state_init(&p);
+
+	test_add_valid_peer(p.peers, &TEST_ADDR0);
+	awdl_peer_get(p.peers, &TEST_ADDR0, &peer0);
+
+	/* lower address, so not adopted on its own */
+	awdl_election_update(&s, &p, peer0);
+	ASSERT_ETHEREQ(s.sync_addr, TEST_ADDR1);
+
+	peer0->election.master_metric = 1000;
+	awdl_election_update(&s, &p, peer0);
+	ASSERT_ETHEREQ(s.sync_addr, TEST_ADDR0);
+	ASSERT_EQ(s.master_metric, 1000);
+	ASSERT_EQ(s.height, 1);
+
+	/* sync master improves: follow without rescan */
+	peer0->election.master_metric = 1100;
+	awdl_election_update(&s, &p, peer0);
+	ASSERT_EQ(s.master_metric, 1100);
+
+	/* another peer with a lower metric is not adopted */
+	test_add_valid_peer(p.peers, &TEST_ADDR2);
+	awdl_peer_get(p.peers, &TEST_ADDR2, &peer1);
+	peer1->election.master_metric = 1050;
+	awdl_election_update(&s, &p, peer1);
+	ASSERT_ETHEREQ(s.sync_addr, TEST_ADDR0);
+
+	/* sync master gets worse: full rescan picks the other peer */
+	peer0->election.master_metric = 900;
+	awdl_election_update(&s, &p, peer0);
+	ASSERT_ETHEREQ(s.sync_addr, TEST_ADDR2);
+	ASSERT_EQ(s.master_metric, 1050);
+
+	/* sync master expires */
+	awdl_election_check(&s, &p);
+	ASSERT_ETHEREQ(s.sync_addr, TEST_ADDR2);
+	awdl_peer_remove(p.peers, &TEST_ADDR2, NULL, NULL);
+	awdl_election_check(&s, &p);
+	ASSERT_ETHEREQ(s.sync_addr, TEST_ADDR0);
+	ASSERT_EQ(s.master_metric, 900);
+
+	awdl_peer_remove(p.peers, &TEST_ADDR0, NULL, NULL);
+	awdl_election_check(&s, &p);
+	ASSERT_ETHEREQ(s.sync_addr, TEST_ADDR1);
+	ASSERT_EQ(s.height, 0);
+	awdl_peers_free(p.peers);
+}
@@ -19,6 +19,7 @@
 
 extern "C" {
 #include "peers.h"
+#include "wire.h"
 }
 
 #include "gtest/gtest.h"
@@ -124,6 +125,280 @@ TEST(awdl_peers, remove_timedout) {
 	awdl_peers_free(p);
 }
 
+TEST(awdl_peers, remove_with_tx_queue) {
+	struct awdl_peer *peer;
+	awdl_peers_t p = awdl_peers_init();
+	awdl_peer_add(p, &TEST_ADDR0, 0, NULL, NULL);
+	awdl_peer_get(p, &TEST_ADDR0, &peer);
+	EXPECT_FALSE(peer->tx_queue);
+	peer->tx_queue = circular_buf_init(4);
+	circular_buf_put2(peer->tx_queue, buf_new_owned(10));
+	circular_buf_put2(peer->tx_queue, buf_new_owned(10));
+	EXPECT_EQ(awdl_peer_remove(p, &TEST_ADDR0, NULL, NULL), PEERS_OK); /* frees queued frames */
+	EXPECT_EQ(awdl_peers_length(p), 0);
+	awdl_peers_free(p);
+}
+
+TEST(awdl_peers, upsert_commit) {
+	struct awdl_peer *peer, *same;
+	awdl_peers_t p = awdl_peers_init();
+
+	EXPECT_EQ(awdl_peer_upsert(p, &TEST_ADDR0, 1, &peer), PEERS_OK);
+	EXPECT_EQ(peer->last_update, 1u);
+	EXPECT_EQ(awdl_peer_upsert(p, &TEST_ADDR0, 2, &same), PEERS_UPDATE);
+	EXPECT_EQ(peer, same);
+	EXPECT_EQ(peer->last_update, 1u); /* only updated on commit */
+
+	count_cb = 0;
+	EXPECT_EQ(awdl_peer_commit(p, peer, 3, test_cb, NULL), PEERS_UPDATE);
+	EXPECT_EQ(peer->last_update, 3u);
+	EXPECT_EQ(count_cb, 0);
+
+	peer->sent_mif = 1;
+	peer->devclass = 1;
+	peer->version = 1;
+	EXPECT_EQ(awdl_peer_commit(p, peer, 4, test_cb, NULL), PEERS_VALID);
+	EXPECT_EQ(count_cb, 1);
+	EXPECT_EQ(awdl_peer_commit(p, peer, 5, test_cb, NULL), PEERS_UPDATE);
+	EXPECT_EQ(count_cb, 1);
+	awdl_peers_free(p);
+}
+
+static struct ether_addr test_addr(int i) {
+	struct ether_addr addr = {{ 0x02, 0x00, 0x00, (uint8_t) (i >> 16), (uint8_t) (i >> 8), (uint8_t) i }};
+	return addr;
+}
+
+TEST(awdl_peers, many) {
+	const int n = 1000;
+	struct awdl_peer *peers[n];
+	struct awdl_peer *peer;
+	awdl_peers_t p = awdl_peers_init();
+
+	for (int i = 0; i < n; i++) {
+		struct ether_addr addr = test_addr(i);
+		EXPECT_EQ(awdl_peer_add(p, &addr, i, NULL, NULL), PEERS_OK);
+		EXPECT_EQ(awdl_peer_get(p, &addr, &peers[i]), PEERS_OK);
+	}
+	EXPECT_EQ(awdl_peers_length(p), n);
+
+	/* remove every other peer, the rest must not move */
+	for (int i = 0; i < n; i += 2) {
+		struct ether_addr addr = test_addr(i);
+		EXPECT_EQ(awdl_peer_remove(p, &addr, NULL, NULL), PEERS_OK);
+	}
+	EXPECT_EQ(awdl_peers_length(p), n / 2);
+	for (int i = 0; i < n; i++) {
+		struct ether_addr addr = test_addr(i);
+		if (i % 2) {
+			EXPECT_EQ(awdl_peer_get(p, &addr, &peer), PEERS_OK);
+			EXPECT_EQ(peer, peers[i]);
+			EXPECT_EQ(peer->last_update, (uint64_t) i);
+		} else {
+			EXPECT_EQ(awdl_peer_get(p, &addr, &peer), PEERS_MISSING);
+		}
+	}
+	awdl_peers_free(p);
+}
+
+TEST(awdl_peers, iterator_remove) {
+	const int n = 100;
+	int visited = 0;
+	struct awdl_peer *peer;
+	awdl_peers_t p = awdl_peers_init();
+
+	for (int i = 0; i < n; i++) {
+		struct ether_addr addr = test_addr(i);
+		awdl_peer_add(p, &addr, i, NULL, NULL);
+	}
+
+	struct awdl_peers_it it;
+	awdl_peers_it_init(&it, p);
+	EXPECT_EQ(awdl_peers_it_remove(&it), PEERS_MISSING);
+	while (awdl_peers_it_next(&it, &peer) == PEERS_OK) {
+		visited++;
+		if (peer->last_update < n / 2) {
+			EXPECT_EQ(awdl_peers_it_remove(&it), PEERS_OK);
+		}
+	}
+
+	EXPECT_EQ(visited, n);
+	EXPECT_EQ(awdl_peers_length(p), n / 2);
+	for (int i = 0; i < n; i++) {
+		struct ether_addr addr = test_addr(i);
+		EXPECT_EQ(awdl_peer_get(p, &addr, NULL), i < n / 2 ? PEERS_MISSING : PEERS_OK);
+	}
+	awdl_peers_free(p);
+}
+
+TEST(awdl_peers, expiry) {
+	const int n = 300;
+	const uint64_t step = PEERS_EXPIRY_RESOLUTION / 3; /* several peers per bucket */
+	const uint64_t start = 1000000000;
+	struct awdl_peer *peer;
+	awdl_peers_t p = awdl_peers_init();
+
+	EXPECT_EQ(awdl_peers_oldest(p), UINT64_MAX);
+	for (int i = 0; i < n; i++) {
+		struct ether_addr addr = test_addr(i);
+		awdl_peer_add(p, &addr, start + i * step, NULL, NULL);
+	}
+	EXPECT_EQ(awdl_peers_oldest(p), start);
+
+	/* refresh the first peer, and touch the second and third one without commit */
+	struct ether_addr addr0 = test_addr(0), addr1 = test_addr(1), addr2 = test_addr(2);
+	awdl_peer_add(p, &addr0, start + n * step, NULL, NULL);
+	awdl_peer_get(p, &addr1, &peer);
+	awdl_peer_touch(p, peer, start + n * step);
+	awdl_peer_get(p, &addr2, &peer);
+	awdl_peer_touch(p, peer, start + n * step);
+	/* no stale bucket may hide the oldest peer */
+	EXPECT_EQ(awdl_peers_oldest(p), start + 3 * step);
+
+	/* expire in small increments, the table must always match a full scan */
+	for (uint64_t before = start; before <= start + (n + 1) * step; before += step / 2) {
+		awdl_peers_remove(p, before, NULL, NULL);
+		for (int i = 0; i < n; i++) {
+			struct ether_addr addr = test_addr(i);
+			uint64_t last_update = i < 3 ? start + n * step : start + i * step;
+			EXPECT_EQ(awdl_peer_get(p, &addr, NULL), last_update < before ? PEERS_MISSING : PEERS_OK);
+		}
+	}
+	EXPECT_EQ(awdl_peers_length(p), 0);
+	EXPECT_EQ(awdl_peers_oldest(p), UINT64_MAX);
+
+	/* a large jump in time expires everything at once */
+	for (int i = 0; i < n; i++) {
+		struct ether_addr addr = test_addr(i);
+		awdl_peer_add(p, &addr, start + (n + 1) * step + i * step, NULL, NULL);
+	}
+	awdl_peers_remove(p, UINT64_MAX, NULL, NULL);
+	EXPECT_EQ(awdl_peers_length(p), 0);
+	awdl_peers_free(p);
+}
+
+static struct ether_addr evicted;
+
+static void evict_cb(struct awdl_peer *p, void *count) {
+	(*(int *) count)++;
+	evicted = p->addr;
+}
+
+TEST(awdl_peers, admit) {
+	struct awdl_peer_state state;
+	struct awdl_peer *peer;
+	struct ether_addr addr;
+	uint64_t now = 1000000;
+	int count = 0;
+
+	awdl_peer_state_init(&state);
+	state.max_peers = 4;
+	state.admit_frames = 2;
+	state.admit_budget = 3;
+
+	/* unknown addresses need two frames */
+	addr = test_addr(0);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now, &peer, NULL, NULL), PEERS_REJECTED);
+	EXPECT_EQ(awdl_peers_length(state.peers), 0);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now + 1, &peer, NULL, NULL), PEERS_OK);
+	EXPECT_EQ(awdl_peers_length(state.peers), 1);
+
+	/* frames must arrive within the timeout */
+	addr = test_addr(1);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now, &peer, NULL, NULL), PEERS_REJECTED);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now + state.timeout + 1, &peer, NULL, NULL), PEERS_REJECTED);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now + state.timeout + 2, &peer, NULL, NULL), PEERS_OK);
+
+	/* only three new peers per window */
+	now += state.timeout + 2;
+	addr = test_addr(2);
+	awdl_peer_admit(&state, &addr, now, &peer, NULL, NULL);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now, &peer, NULL, NULL), PEERS_OK);
+	addr = test_addr(3);
+	awdl_peer_admit(&state, &addr, now, &peer, NULL, NULL);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now, &peer, NULL, NULL), PEERS_OK);
+	addr = test_addr(4);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now, &peer, NULL, NULL), PEERS_REJECTED);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now, &peer, NULL, NULL), PEERS_REJECTED);
+	EXPECT_EQ(awdl_peers_length(state.peers), 4);
+
+	/* table is full: evict the oldest peer that never turned valid (2), not the valid one (0) */
+	now += state.admit_window;
+	addr = test_addr(0);
+	awdl_peer_get(state.peers, &addr, &peer);
+	peer->sent_mif = peer->devclass = peer->version = 1;
+	awdl_peer_commit(state.peers, peer, now - PEERS_EXPIRY_RESOLUTION * 100, NULL, NULL);
+	addr = test_addr(1);
+	awdl_peer_get(state.peers, &addr, &peer);
+	awdl_peer_commit(state.peers, peer, now, NULL, NULL);
+	addr = test_addr(3);
+	awdl_peer_get(state.peers, &addr, &peer);
+	awdl_peer_commit(state.peers, peer, now, NULL, NULL);
+
+	addr = test_addr(5);
+	awdl_peer_admit(&state, &addr, now, &peer, evict_cb, &count);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now, &peer, evict_cb, &count), PEERS_OK);
+	EXPECT_EQ(count, 1);
+	EXPECT_EQ(awdl_peers_length(state.peers), 4);
+	addr = test_addr(2);
+	EXPECT_EQ(awdl_peer_get(state.peers, &addr, NULL), PEERS_MISSING);
+	EXPECT_FALSE(memcmp(&evicted, &addr, sizeof(addr)));
+
+	/* only valid peers left that are older than the rest: evict the valid one */
+	addr = test_addr(1);
+	awdl_peer_get(state.peers, &addr, &peer);
+	peer->sent_mif = peer->devclass = peer->version = 1;
+	awdl_peer_commit(state.peers, peer, now, NULL, NULL);
+	addr = test_addr(3);
+	awdl_peer_get(state.peers, &addr, &peer);
+	peer->sent_mif = peer->devclass = peer->version = 1;
+	awdl_peer_commit(state.peers, peer, now, NULL, NULL);
+	addr = test_addr(5);
+	awdl_peer_get(state.peers, &addr, &peer);
+	peer->sent_mif = peer->devclass = peer->version = 1;
+	awdl_peer_commit(state.peers, peer, now, NULL, NULL);
+	addr = test_addr(6);
+	awdl_peer_admit(&state, &addr, now, &peer, evict_cb, &count);
+	EXPECT_EQ(awdl_peer_admit(&state, &addr, now, &peer, evict_cb, &count), PEERS_OK);
+	EXPECT_EQ(count, 2);
+	addr = test_addr(0);
+	EXPECT_EQ(awdl_peer_get(state.peers, &addr, NULL), PEERS_MISSING);
+	EXPECT_FALSE(memcmp(&evicted, &addr, sizeof(addr)));
+
+	/* awdl_peer_add is not subject to limits */
+	for (int i = 10; i < 20; i++) {
+		addr = test_addr(i);
+		EXPECT_EQ(awdl_peer_add(state.peers, &addr, now, NULL, NULL), PEERS_OK);
+	}
+	EXPECT_EQ(awdl_peers_length(state.peers), 14);
+	awdl_peers_free(state.peers);
+}
+
+TEST(awdl_peers, admit_after_miss) {
+	const int max = 64, n = 256;
+	struct awdl_peer_state state;
+	struct awdl_peer *peer;
+
+	awdl_peer_state_init(&state);
+	state.max_peers = max;
+	state.admit_frames = 1;
+	state.admit_budget = 0;
+
+	/* as on the RX path: a failed lookup, then admission evicts a peer before inserting the new one */
+	for (int i = 0; i < n; i++) {
+		struct ether_addr addr = test_addr(i);
+		EXPECT_EQ(awdl_peer_get(state.peers, &addr, NULL), PEERS_MISSING);
+		EXPECT_EQ(awdl_peer_admit(&state, &addr, i * PEERS_EXPIRY_RESOLUTION, &peer, NULL, NULL), PEERS_OK);
+		EXPECT_FALSE(memcmp(&peer->addr, &addr, sizeof(addr)));
+	}
+	EXPECT_EQ(awdl_peers_length(state.peers), max);
+	for (int i = 0; i < n; i++) {
+		struct ether_addr addr = test_addr(i);
+		EXPECT_EQ(awdl_peer_get(state.peers, &addr, NULL), i < n - max ? PEERS_MISSING : PEERS_OK);
+	}
+	awdl_peers_free(state.peers);
+}
+
 TEST(awdl_peers, print) {
 	char buf[1000]; // Buffer is large enough
 	awdl_peers_t p = awdl_peers_init();
@@ -0,0 +1,236 @@
+/*
+ * OWL: an open Apple Wireless Direct Link (AWDL) implementation
+ * Copyright (C) 2018  The Open Wireless Link Project
+ * Copyright (C) 2018  Milan Stute
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+extern "C" {
+#include "rx.h"
+#include "tx.h"
+#include "wire.h"
+}
+
+#include "gtest/gtest.h"
+
+static const struct ether_addr SELF = {{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 }};
+static const struct ether_addr PEER = {{ 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }};
+
+static const uint8_t LLC_AWDL_DATA[] = {
+	0xaa, 0xaa, 0x03, 0x00, 0x17, 0xf2, 0x08, 0x00, /* LLC/SNAP */
+	0x03, 0x04, 0x00, 0x00, 0x00, 0x00, 0x86, 0xdd, /* AWDL data header (IPv6) */
+};
+
+struct received {
+	int count;
+	struct ether_header hdr;
+	const uint8_t *payload;
+	int len;
+};
+
+static void on_data(const struct ether_header *hdr, const struct buf *payload, void *data) {
+	struct received *r = (struct received *) data;
+	r->count++;
+	r->hdr = *hdr;
+	r->payload = buf_data(payload);
+	r->len = buf_len(payload);
+}
+
+class awdl_rx_data_test : public ::testing::Test {
+protected:
+	struct awdl_state state;
+	struct received r;
+
+	void SetUp() override {
+		awdl_init_state(&state, "test", &SELF, CHAN_OPCLASS_6, 0);
+		awdl_peer_add(state.peers.peers, &PEER, 0, NULL, NULL);
+		memset(&r, 0, sizeof(r));
+		state.data_cb = on_data;
+		state.data_cb_data = &r;
+	}
+
+	void TearDown() override {
+		awdl_peers_free(state.peers.peers);
+	}
+};
+
+TEST_F(awdl_rx_data_test, payload_not_copied) {
+	uint8_t frame[sizeof(LLC_AWDL_DATA) + 4];
+	memcpy(frame, LLC_AWDL_DATA, sizeof(LLC_AWDL_DATA));
+	memset(frame + sizeof(LLC_AWDL_DATA), 0xab, 4);
+
+	const struct buf *buf = buf_new_const(frame, sizeof(frame));
+	EXPECT_EQ(awdl_rx_data(buf, &PEER, &SELF, &state), RX_OK);
+	buf_free(buf);
+
+	EXPECT_EQ(r.count, 1);
+	EXPECT_EQ(memcmp(r.hdr.ether_dhost, &SELF, ETHER_ADDR_LEN), 0);
+	EXPECT_EQ(memcmp(r.hdr.ether_shost, &PEER, ETHER_ADDR_LEN), 0);
+	EXPECT_EQ(be16toh(r.hdr.ether_type), 0x86dd);
+	EXPECT_EQ(r.payload, frame + sizeof(LLC_AWDL_DATA));
+	EXPECT_EQ(r.len, 4);
+}
+
+TEST_F(awdl_rx_data_test, unknown_peer) {
+	const struct buf *buf = buf_new_const(LLC_AWDL_DATA, sizeof(LLC_AWDL_DATA));
+	EXPECT_EQ(awdl_rx_data(buf, &SELF, &PEER, &state), RX_IGNORE_PEER);
+	buf_free(buf);
+	EXPECT_EQ(r.count, 0);
+}
+
+TEST_F(awdl_rx_data_test, amsdu_many_subframes) {
+	const int num = 32; /* more than the former limit of 16 */
+	const int sub_len = sizeof(LLC_AWDL_DATA) + 1; /* odd length to require padding */
+	uint8_t frame[num * 36];
+	int offset = 0;
+
+	for (int i = 0; i < num; i++) {
+		memcpy(frame + offset, &SELF, ETHER_ADDR_LEN);
+		memcpy(frame + offset + 6, &PEER, ETHER_ADDR_LEN);
+		frame[offset + 12] = 0;
+		frame[offset + 13] = sub_len;
+		memcpy(frame + offset + 14, LLC_AWDL_DATA, sizeof(LLC_AWDL_DATA));
+		frame[offset + 14 + sizeof(LLC_AWDL_DATA)] = i;
+		offset += 14 + sub_len;
+		if (i < num - 1)
+			offset += (4 - (offset % 4)) % 4;
+	}
+
+	const struct buf *buf = buf_new_const(frame, offset);
+	EXPECT_EQ(awdl_rx_data_amsdu(buf, &PEER, &SELF, &state), RX_OK);
+	buf_free(buf);
+
+	EXPECT_EQ(r.count, num);
+	EXPECT_EQ(r.len, 1);
+	EXPECT_EQ(r.payload[0], num - 1);
+}
+
+static void count_tlv(struct awdl_peer *, uint8_t, const struct buf *val, struct awdl_state *, void *data) {
+	int *bytes = (int *) data;
+	*bytes += 3 + buf_len(val);
+}
+
+TEST(awdl_rx_action, parse_tlvs) {
+	struct awdl_state self, peer;
+	uint8_t frame[1024];
+	uint8_t *ptr = frame;
+	int tlv_bytes = 0;
+
+	awdl_init_state(&self, "self", &SELF, CHAN_OPCLASS_6, 0);
+	awdl_init_state(&peer, "peer", &PEER, CHAN_OPCLASS_6, 0);
+	self.filter_rssi = 0;
+	self.peers.admit_frames = 1; /* admit the peer with its first frame */
+	self.tlv_cb = count_tlv;
+	self.tlv_cb_data = &tlv_bytes;
+
+	ptr += awdl_init_action(ptr, AWDL_ACTION_PSF, 0);
+	uint8_t *tlvs = ptr;
+	ptr += awdl_init_sync_params_tlv(ptr, &peer, 0);
+	ptr += awdl_init_election_params_tlv(ptr, &peer);
+	ptr += awdl_init_chanseq_tlv(ptr, &peer);
+	ptr += awdl_init_election_params_v2_tlv(ptr, &peer);
+	ptr += awdl_init_service_params_tlv(ptr, &peer);
+	ptr += awdl_init_arpa_tlv(ptr, &peer);
+	ptr += awdl_init_data_path_state_tlv(ptr, &peer);
+	ptr += awdl_init_version_tlv(ptr, &peer);
+
+	struct buf view;
+	const struct buf *buf = buf_init_const(&view, frame, ptr - frame);
+	EXPECT_EQ(awdl_rx_action(buf, 0, 0, &PEER, &SELF, &self), RX_OK);
+	EXPECT_EQ(tlv_bytes, ptr - tlvs);
+	EXPECT_EQ(awdl_peers_length(self.peers.peers), 1);
+
+	/* known peer, see bench_rx for heap allocations on this path */
+	buf = buf_init_const(&view, frame, ptr - frame); /* the first call consumed the view */
+	EXPECT_EQ(awdl_rx_action(buf, 0, 0, &PEER, &SELF, &self), RX_OK);
+	EXPECT_EQ(tlv_bytes, 2 * (ptr - tlvs));
+	EXPECT_EQ(awdl_peers_length(self.peers.peers), 1);
+
+	awdl_peers_free(self.peers.peers);
+	awdl_peers_free(peer.peers.peers);
+}
+
+TEST(awdl_rx_action, tx_delay) {
+	struct awdl_state self;
+	struct ieee80211_state ieee80211_state;
+	struct awdl_sync_params_tlv *tlv;
+	uint8_t frame[AWDL_ACTION_TEMPLATE_MAX_LEN];
+	int len;
+
+	awdl_init_state(&self, "self", &SELF, CHAN_OPCLASS_6, 0);
+	ieee80211_init_state(&ieee80211_state);
+
+	/* our own PSF comes back 800 us after it was built */
+	len = awdl_init_full_action_frame(frame, &self, &ieee80211_state, AWDL_ACTION_PSF, 1000);
+	struct buf view;
+	EXPECT_EQ(awdl_rx(buf_init_const(&view, frame, len), 1800, &self), RX_IGNORE_FROM_SELF);
+	EXPECT_EQ(self.sync.tx_delay, 800u);
+	EXPECT_EQ(self.sync.tx_delay_samples, 1u);
+
+	/* frames that were held back do not count */
+	EXPECT_EQ(awdl_rx(buf_init_const(&view, frame, len), 1000 + AWDL_SYNC_TX_DELAY_MAX + 1, &self),
+	          RX_IGNORE_FROM_SELF);
+	EXPECT_EQ(self.sync.tx_delay_samples, 1u);
+
+	/* advertised timing is where we will be once on air */
+	self.sync.tx_delay = ieee80211_tu_to_usec(10);
+	awdl_init_sync_params_tlv(frame, &self, 0);
+	tlv = (struct awdl_sync_params_tlv *) frame;
+	EXPECT_EQ(le16toh(tlv->tx_down_counter), 64 - 10);
+
+	awdl_peers_free(self.peers.peers);
+}
+
+TEST_F(awdl_rx_data_test, amsdu_tx_roundtrip) {
+	struct ieee80211_state ieee80211_state;
+	struct awdl_state peer;
+	uint8_t frame[512];
+	const struct buf *frames[3];
+	int len, hdr_len;
+
+	awdl_init_state(&peer, "peer", &PEER, CHAN_OPCLASS_6, 0);
+	ieee80211_init_state(&ieee80211_state);
+
+	for (int i = 0; i < 3; i++) {
+		struct buf *eth = buf_new_owned(ETHER_HDR_LEN + i + 1); /* lengths require padding */
+		write_ether_addr(eth, 0, &SELF);
+		write_ether_addr(eth, 6, &PEER);
+		write_be16(eth, 12, ETH_P_IPV6);
+		for (int j = 0; j <= i; j++)
+			write_u8(eth, ETHER_HDR_LEN + j, i);
+		frames[i] = eth;
+	}
+
+	len = awdl_init_full_amsdu_frame(frame, &PEER, &SELF, frames, 3, &peer, &ieee80211_state);
+
+	/* strip radiotap, 802.11 and QoS headers */
+	hdr_len = frame[2] + sizeof(struct ieee80211_hdr);
+	struct ieee80211_hdr *ieee80211 = (struct ieee80211_hdr *) (frame + frame[2]);
+	EXPECT_EQ(le16toh(ieee80211->frame_control), IEEE80211_FTYPE_DATA | IEEE80211_STYPE_QOS_DATA);
+	EXPECT_EQ(le16toh(*(uint16_t *) (frame + hdr_len)), IEEE80211_QOS_CTL_A_MSDU_PRESENT);
+	hdr_len += IEEE80211_QOS_CTL_LEN;
+
+	struct buf view;
+	const struct buf *buf = buf_init_const(&view, frame + hdr_len, len - hdr_len);
+	EXPECT_EQ(awdl_rx_data_amsdu(buf, &PEER, &SELF, &state), RX_OK);
+	EXPECT_EQ(r.count, 3);
+	EXPECT_EQ(r.len, 3);
+	EXPECT_EQ(r.payload[2], 2);
+	EXPECT_EQ(be16toh(r.hdr.ether_type), ETH_P_IPV6);
+
+	for (int i = 0; i < 3; i++)
+		buf_free(frames[i]);
+	awdl_peers_free(peer.peers.peers);
+}
@@ -19,6 +19,7 @@
 
 extern "C" {
 #include "sync.h"
+#include "schedule.h"
 #include "ieee80211.h"
 }
 
@@ -79,3 +80,267 @@ TEST(awdl_sync, current_aw_timedelta) {
     }
   }
 }
+
+TEST(awdl_sync, slot_at) {
+  uint64_t start = 1000000;
+  struct awdl_sync_state *state = test_state(start);
+  uint64_t len = ieee80211_tu_to_usec(64);
+  struct awdl_slot slot;
+
+  for (uint64_t eaw = 0; eaw < 2 * AWDL_CHANSEQ_LENGTH; eaw++) {
+    uint64_t times[] = { start + eaw * len, start + eaw * len + len / 2, start + (eaw + 1) * len - 1 };
+    for (uint64_t now : times) {
+      awdl_slot_at(state, now, &slot);
+      EXPECT_EQ(slot.start, start + eaw * len);
+      EXPECT_EQ(slot.end, start + (eaw + 1) * len);
+      EXPECT_EQ(slot.eaw, eaw);
+      EXPECT_EQ(slot.index, eaw % AWDL_CHANSEQ_LENGTH);
+    }
+  }
+}
+
+TEST(awdl_sync, guard_bounds) {
+  static struct awdl_state state;
+  struct ether_addr self = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}};
+  awdl_init_state(&state, "test", &self, CHAN_NULL, 0);
+
+  /* maximum guards until we have measured anything */
+  EXPECT_EQ(state.guard.unicast, ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
+  EXPECT_EQ(state.guard.multicast, ieee80211_tu_to_usec(AWDL_MULTICAST_GUARD_TU));
+  awdl_guard_update(&state, 0);
+  EXPECT_EQ(state.guard.unicast, ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
+
+  /* fast hardware and perfect sync */
+  awdl_guard_update(&state, 100);
+  EXPECT_EQ(state.guard.unicast, (uint32_t) AWDL_UNICAST_GUARD_MIN_US);
+  EXPECT_EQ(state.guard.multicast, (uint32_t) AWDL_MULTICAST_GUARD_MIN_US);
+
+  /* in between */
+  state.sync.meas_err_avg = 1500;
+  awdl_guard_update(&state, 0);
+  EXPECT_EQ(state.guard.unicast, 2000u);
+  EXPECT_EQ(state.guard.multicast, 4 * 1600u);
+  state.sync.meas_err_avg = 0;
+
+  /* slow hardware */
+  for (int i = 0; i < 64; i++)
+    awdl_guard_update(&state, 100000);
+  EXPECT_EQ(state.guard.unicast, ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
+  EXPECT_EQ(state.guard.multicast, ieee80211_tu_to_usec(AWDL_MULTICAST_GUARD_TU));
+
+  /* unreliable sync */
+  state.guard.switch_latency = 100;
+  for (int i = 0; i < 10; i++)
+    awdl_sync_meas_err(&state.sync, i < 8 ? 0 : 10);
+  awdl_guard_update(&state, 0);
+  EXPECT_EQ(state.guard.unicast, ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
+}
+
+TEST(awdl_sync, guard_recent_errors) {
+  static struct awdl_state state;
+  struct ether_addr self = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}};
+  awdl_init_state(&state, "test", &self, CHAN_NULL, 0);
+  awdl_guard_update(&state, 100);
+
+  /* errors during the initial synchronization do not keep the guards wide */
+  for (int i = 0; i < 20; i++)
+    awdl_sync_meas_err(&state.sync, 10);
+  awdl_guard_update(&state, 0);
+  EXPECT_EQ(state.guard.unicast, ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
+  for (int i = 0; i < 100; i++)
+    awdl_sync_meas_err(&state.sync, 0);
+  awdl_guard_update(&state, 0);
+  EXPECT_EQ(state.guard.unicast, (uint32_t) AWDL_UNICAST_GUARD_MIN_US);
+
+  /* a burst of errors after a long clean run widens them again */
+  for (int i = 0; i < 10000; i++)
+    awdl_sync_meas_err(&state.sync, 1);
+  awdl_guard_update(&state, 0);
+  EXPECT_LT(state.guard.unicast, ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
+  for (int i = 0; i < 3; i++)
+    awdl_sync_meas_err(&state.sync, -10);
+  awdl_guard_update(&state, 0);
+  EXPECT_EQ(state.guard.unicast, ieee80211_tu_to_usec(AWDL_UNICAST_GUARD_TU));
+  EXPECT_EQ(state.guard.multicast, ieee80211_tu_to_usec(AWDL_MULTICAST_GUARD_TU));
+}
+
+TEST(awdl_sync, meas_err_avg) {
+  struct awdl_sync_state *state = test_state(0);
+
+  awdl_sync_meas_err(state, -8);
+  EXPECT_EQ(state->meas_err_avg, ieee80211_tu_to_usec(8) / 8);
+  for (int i = 0; i < 256; i++)
+    awdl_sync_meas_err(state, 1000); /* capped at one EAW */
+  EXPECT_LE(state->meas_err_avg, ieee80211_tu_to_usec(64));
+  EXPECT_GT(state->meas_err_avg, ieee80211_tu_to_usec(60));
+}
+
+TEST(awdl_sync, peer_overlap) {
+  static struct awdl_state state;
+  struct ether_addr self = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}};
+  struct ether_addr other = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x66}};
+  uint64_t len = ieee80211_tu_to_usec(64);
+  struct awdl_peer *peer;
+
+  struct awdl_chan chan = CHAN_OPCLASS_149;
+
+  awdl_init_state(&state, "test", &self, CHAN_OPCLASS_6, 0);
+  awdl_peer_add(state.peers.peers, &other, 0, NULL, NULL);
+  ASSERT_EQ(awdl_peer_get(state.peers.peers, &other, &peer), PEERS_OK);
+
+  /* no sequence known yet */
+  awdl_peer_update_overlap(&state, peer);
+  EXPECT_EQ(peer->overlap, 0);
+  EXPECT_EQ(awdl_next_overlap_in_us(&state, peer, 0), UINT64_MAX);
+
+  /* peer is on our channel in slots 3 and 10 only */
+  awdl_chanseq_init_static(peer->sequence, &chan);
+  peer->sequence[3] = CHAN_OPCLASS_6;
+  peer->sequence[10] = CHAN_OPCLASS_6;
+  awdl_peer_update_overlap(&state, peer);
+  EXPECT_EQ(peer->overlap, (1 << 3) | (1 << 10));
+  EXPECT_EQ(peer->next_overlap[3], 0);
+  EXPECT_EQ(peer->next_overlap[2], 1);
+  EXPECT_EQ(peer->next_overlap[4], 6);
+  EXPECT_EQ(peer->next_overlap[11], 8); /* wraps around */
+
+  EXPECT_TRUE(awdl_same_channel_as_peer(&state, 3 * len + 1, peer));
+  EXPECT_FALSE(awdl_same_channel_as_peer(&state, 4 * len, peer));
+  EXPECT_EQ(awdl_next_overlap_in_us(&state, peer, 3 * len + 100), 0u);
+  EXPECT_EQ(awdl_next_overlap_in_us(&state, peer, 2 * len + 100), len - 100);
+  EXPECT_EQ(awdl_next_overlap_in_us(&state, peer, 11 * len), 8 * len);
+
+  /* peer is one slot ahead of us */
+  peer->sync_offset = len;
+  awdl_peer_update_overlap(&state, peer);
+  EXPECT_EQ(peer->overlap, (1 << 2) | (1 << 9));
+
+  awdl_peers_free(state.peers.peers);
+}
+
+/* Sync params as sent by a master whose clock runs {@code ppm} faster than ours */
+static void master_params(uint64_t now, double ppm, uint16_t *time_to_next_aw, uint16_t *aw_counter) {
+  uint64_t eaw_period = ieee80211_tu_to_usec(64);
+  uint64_t master = (uint64_t) (now * (1 + ppm / 1000000)) + 12345;
+  *time_to_next_aw = 64 - ieee80211_usec_to_tu(master % eaw_period); /* like awdl_sync_next_aw_tu */
+  *aw_counter = (uint16_t) (master / ieee80211_tu_to_usec(16));
+}
+
+static int64_t master_error_us(uint64_t now, double ppm, const struct awdl_sync_state *state) {
+  uint64_t eaw_period = ieee80211_tu_to_usec(64);
+  uint64_t master = (uint64_t) (now * (1 + ppm / 1000000)) + 12345;
+  int64_t err = (int64_t) (eaw_period - master % eaw_period) - (int64_t) awdl_sync_next_aw_us(now, state);
+  if (err > (int64_t) eaw_period / 2)
+    err -= eaw_period;
+  else if (err < -(int64_t) eaw_period / 2)
+    err += eaw_period;
+  return err;
+}
+
+TEST(awdl_sync, drift_holdover) {
+  const double ppm = 120;
+  const struct ether_addr master = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}};
+  struct awdl_sync_state *state = test_state(0);
+  uint16_t time_to_next_aw, aw_counter;
+  uint64_t now = 0;
+
+  /* a PSF every 110 TU for 60 s */
+  for (int i = 0; i < 530; i++) {
+    now += ieee80211_tu_to_usec(110) + (i * 7919) % 1000; /* some jitter */
+    master_params(now, ppm, &time_to_next_aw, &aw_counter);
+    awdl_sync_update(now, time_to_next_aw, aw_counter, &master, state);
+  }
+  EXPECT_NEAR(state->freq_ppb, ppm * 1000, 30000);
+  EXPECT_LT(llabs(master_error_us(now, ppm, state)), 512); /* master only sends TU */
+  EXPECT_FALSE(awdl_sync_is_holdover(now, state));
+
+  /* master is silent for 10 s: a free-running clock would be off by 1.2 ms */
+  now += 10000000;
+  EXPECT_TRUE(awdl_sync_is_holdover(now, state));
+  EXPECT_LT(llabs(master_error_us(now, ppm, state)), 512);
+
+  /* a new master resets the estimate */
+  const struct ether_addr other = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x56}};
+  master_params(now, 0, &time_to_next_aw, &aw_counter);
+  awdl_sync_update(now, time_to_next_aw, aw_counter, &other, state);
+  EXPECT_EQ(state->freq_ppb, 0);
+  EXPECT_EQ(awdl_sync_error_tu(now, time_to_next_aw, aw_counter, state), 0);
+}
+
+TEST(awdl_sync, tsf_to_local) {
+  struct awdl_sync_state *state = test_state(0);
+  const uint64_t tsf_base = 5000000000; /* TSF is unrelated to our clock */
+  const uint64_t local_base = 1000000;
+
+  /* first frame arrives 300 us late */
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, tsf_base, local_base + 300), local_base + 300);
+  /* a less delayed frame improves the offset right away */
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, tsf_base + 1000, local_base + 1050), local_base + 1050);
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, tsf_base + 2000, local_base + 2000 + 50), local_base + 2050);
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, tsf_base + 3000, local_base + 3000 + 10), local_base + 3010);
+  /* more delayed frames are mapped with the smallest delay seen */
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, tsf_base + 4000, local_base + 4000 + 810), local_base + 4010);
+  /* never in the future */
+  EXPECT_LE(awdl_sync_tsf_to_local(state, tsf_base + 5000, local_base + 5000), local_base + 5000);
+
+  /* the minimum grows by at most the maximum drift, 200 ppm: 1 us per 5 ms */
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, tsf_base + 10000, local_base + 10000 + 800), local_base + 10000 + 1);
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, tsf_base + 15000, local_base + 15000 + 800), local_base + 15000 + 2);
+  /* but follows a clock running slower than ours after a long time */
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, tsf_base + 1000000, local_base + 1000000 + 60), local_base + 1000060);
+
+  /* TSF was reset */
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, 42, local_base + 2000000), local_base + 2000000);
+  EXPECT_EQ(awdl_sync_tsf_to_local(state, 1042, local_base + 2001100), local_base + 2001000);
+}
+
+/* Sync params as sent by a peer whose schedule is {@code offset} us ahead of ours */
+static void peer_params(uint64_t now, int64_t offset, uint16_t *time_to_next_aw, uint16_t *aw_counter) {
+  uint64_t eaw_period = ieee80211_tu_to_usec(64);
+  uint64_t peer = now + 100 * AWDL_CHANSEQ_LENGTH * eaw_period + offset;
+  *time_to_next_aw = 64 - ieee80211_usec_to_tu(peer % eaw_period);
+  *aw_counter = (uint16_t) (peer / ieee80211_tu_to_usec(16));
+}
+
+TEST(awdl_sync, peer_sync_offset) {
+  static struct awdl_state state;
+  struct ether_addr self = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}};
+  struct ether_addr other = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x66}};
+  int64_t len = ieee80211_tu_to_usec(64);
+  uint16_t time_to_next_aw, aw_counter;
+  uint64_t now = 10 * len + 1000;
+  struct awdl_peer *peer;
+
+  struct awdl_chan chan = CHAN_OPCLASS_149;
+
+  awdl_init_state(&state, "test", &self, CHAN_OPCLASS_6, 0);
+  awdl_peer_add(state.peers.peers, &other, 0, NULL, NULL);
+  ASSERT_EQ(awdl_peer_get(state.peers.peers, &other, &peer), PEERS_OK);
+  awdl_chanseq_init_static(peer->sequence, &chan);
+  peer->sequence[3] = CHAN_OPCLASS_6;
+  awdl_peer_update_overlap(&state, peer);
+  EXPECT_EQ(peer->overlap, 1 << 3);
+
+  /* peer is one slot (and a bit) ahead of us */
+  peer_params(now, len + 10000, &time_to_next_aw, &aw_counter);
+  awdl_peer_update_sync(&state, peer, now, time_to_next_aw, aw_counter);
+  EXPECT_TRUE(peer->sync_valid);
+  EXPECT_NEAR(peer->sync_offset, len + 10000, 512);
+  EXPECT_EQ(peer->overlap, 1 << 2);
+
+  /* a single outlier only moves the estimate a little */
+  now += len;
+  peer_params(now, len + 40000, &time_to_next_aw, &aw_counter);
+  awdl_peer_update_sync(&state, peer, now, time_to_next_aw, aw_counter);
+  EXPECT_NEAR(peer->sync_offset, len + 10000 + 30000 / AWDL_PEER_SYNC_SMOOTHING, 512);
+  EXPECT_EQ(peer->overlap, 1 << 2);
+
+  /* peer resynced and is now one slot behind us, which is the same as 15 slots ahead */
+  now += len;
+  peer_params(now, (AWDL_CHANSEQ_LENGTH - 1) * len, &time_to_next_aw, &aw_counter);
+  awdl_peer_update_sync(&state, peer, now, time_to_next_aw, aw_counter);
+  EXPECT_NEAR(peer->sync_offset, -len, 512);
+  EXPECT_EQ(peer->overlap, 1 << 4);
+
+  awdl_peers_free(state.peers.peers);
+}
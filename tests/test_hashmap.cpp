@@ -0,0 +1,113 @@
+/*
+ * OWL: an open Apple Wireless Direct Link (AWDL) implementation
+ * Copyright (C) 2018  The Open Wireless Link Project
+ * Copyright (C) 2018  Milan Stute
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+extern "C" {
+#include "hashmap.h"
+}
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#define NUM_KEYS 5000
+
+TEST(hashmap, put_get_remove) {
+	map_t map = hashmap_new(sizeof(uint32_t));
+	std::vector<uint32_t> keys(NUM_KEYS);
+	any_t value;
+
+	for (uint32_t i = 0; i < NUM_KEYS; i++) {
+		keys[i] = i;
+		EXPECT_EQ(MAP_OK, hashmap_put(map, &keys[i], &keys[i]));
+	}
+	EXPECT_EQ(NUM_KEYS, hashmap_length(map));
+
+	/* Replacing a value does not add an element */
+	EXPECT_EQ(MAP_OK, hashmap_put(map, &keys[0], &keys[1]));
+	EXPECT_EQ(NUM_KEYS, hashmap_length(map));
+	EXPECT_EQ(MAP_OK, hashmap_get(map, &keys[0], &value, 0));
+	EXPECT_EQ(&keys[1], value);
+	EXPECT_EQ(MAP_OK, hashmap_put(map, &keys[0], &keys[0]));
+
+	/* Remove every other key, all remaining keys must still be found */
+	for (uint32_t i = 0; i < NUM_KEYS; i += 2)
+		EXPECT_EQ(MAP_OK, hashmap_get(map, &keys[i], NULL, 1));
+	EXPECT_EQ(NUM_KEYS / 2, hashmap_length(map));
+	for (uint32_t i = 0; i < NUM_KEYS; i++) {
+		uint32_t key = i; /* lookup by value, not by stored pointer */
+		if (i % 2) {
+			EXPECT_EQ(MAP_OK, hashmap_get(map, &key, &value, 0));
+			EXPECT_EQ(&keys[i], value);
+		} else {
+			EXPECT_EQ(MAP_MISSING, hashmap_get(map, &key, &value, 0));
+			EXPECT_EQ(NULL, value);
+		}
+	}
+
+	/* Shrink back down */
+	for (uint32_t i = 1; i < NUM_KEYS; i += 2)
+		EXPECT_EQ(MAP_OK, hashmap_get(map, &keys[i], NULL, 1));
+	EXPECT_EQ(0, hashmap_length(map));
+	EXPECT_EQ(MAP_MISSING, hashmap_get(map, &keys[1], NULL, 1));
+
+	hashmap_free(map);
+}
+
+TEST(hashmap, iterator_remove) {
+	map_t map = hashmap_new(sizeof(uint32_t));
+	std::vector<uint32_t> keys(NUM_KEYS);
+	std::vector<int> seen(NUM_KEYS);
+	struct hashmap_it it;
+	mkey_t key;
+	any_t value;
+
+	for (uint32_t i = 0; i < NUM_KEYS; i++) {
+		keys[i] = i;
+		hashmap_put(map, &keys[i], &keys[i]);
+	}
+
+	/* Removing during iteration must neither skip nor repeat elements */
+	hashmap_it_init(&it, map);
+	EXPECT_EQ(MAP_MISSING, hashmap_it_remove(&it));
+	while (hashmap_it_next(&it, &key, &value) == MAP_OK) {
+		uint32_t i = *(uint32_t *) key;
+		EXPECT_EQ(&keys[i], value);
+		seen[i]++;
+		if (i % 3 == 0) {
+			EXPECT_EQ(MAP_OK, hashmap_it_remove(&it));
+			EXPECT_EQ(MAP_MISSING, hashmap_it_remove(&it));
+		}
+	}
+	for (uint32_t i = 0; i < NUM_KEYS; i++)
+		EXPECT_EQ(1, seen[i]);
+	EXPECT_EQ(NUM_KEYS - (NUM_KEYS + 2) / 3, hashmap_length(map));
+
+	for (uint32_t i = 0; i < NUM_KEYS; i++)
+		EXPECT_EQ(i % 3 ? MAP_OK : MAP_MISSING, hashmap_get(map, &keys[i], NULL, 0));
+
+	/* Heap-allocated iterator still works */
+	map_it_t hit = hashmap_it_new(map);
+	int count = 0;
+	while (hashmap_it_next(hit, NULL, NULL) == MAP_OK)
+		count++;
+	hashmap_it_free(hit);
+	EXPECT_EQ(hashmap_length(map), count);
+
+	hashmap_free(map);
+}
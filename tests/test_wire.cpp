@@ -55,6 +55,51 @@ wire_error:
 	destroy_test_buf(frame);
 }
 
+TEST(wire, buf_init_const) {
+	const uint8_t data[] = { 1, 2, 3 };
+	struct buf view;
+	const struct buf *frame = buf_init_const(&view, data, sizeof(data));
+
+	EXPECT_EQ(frame, &view);
+	EXPECT_EQ(buf_data(frame), data);
+	EXPECT_EQ(buf_len(frame), 3);
+
+	EXPECT_EQ(buf_strip(frame, 1), 1);
+	uint8_t x;
+	EXPECT_EQ(read_u8(frame, 0, &x), 1);
+	EXPECT_EQ(x, 2);
+	EXPECT_EQ(buf_len(frame), 2);
+	EXPECT_LT(read_u8(frame, 2, NULL), 0);
+
+	EXPECT_EQ(buf_init_const(&view, data, -1), (const struct buf *) NULL);
+}
+
+TEST(wire, buf_push_put) {
+	struct buf *frame = buf_new_owned_reserve(2, 1, 1);
+
+	EXPECT_EQ(buf_headroom(frame), 2);
+	EXPECT_EQ(buf_tailroom(frame), 1);
+	write_u8(frame, 0, 1);
+
+	EXPECT_EQ(buf_push(frame, 3), (uint8_t *) NULL);
+	uint8_t *head = buf_push(frame, 2);
+	EXPECT_EQ(head, buf_data(frame));
+	EXPECT_EQ(buf_headroom(frame), 0);
+	EXPECT_EQ(buf_len(frame), 3);
+
+	EXPECT_EQ(buf_put(frame, 2), (uint8_t *) NULL);
+	uint8_t *tail = buf_put(frame, 1);
+	EXPECT_EQ(tail, buf_data(frame) + 3);
+	EXPECT_EQ(buf_tailroom(frame), 0);
+	EXPECT_EQ(buf_len(frame), 4);
+
+	uint8_t x;
+	read_u8(frame, 2, &x);
+	EXPECT_EQ(x, 1);
+
+	destroy_test_buf(frame);
+}
+
 TEST(wire, buf_take_oob) {
 	bool success = 0;
 	struct buf *frame = create_test_buf(1);
@@ -144,7 +189,7 @@ TEST(wire, read_tlv) {
   ptr = (uint8_t *) buf_data(frame);
   start = ptr;
 
-  ptr += awdl_init_sync_params_tlv(ptr, &state);
+  ptr += awdl_init_sync_params_tlv(ptr, &state, 0);
   ptr += awdl_init_election_params_tlv(ptr, &state);
   ptr += awdl_init_chanseq_tlv(ptr, &state);
   ptr += awdl_init_service_params_tlv(ptr, &state);
@@ -531,3 +576,83 @@ TEST(wire, write_read_bytes) {
 
   destroy_test_buf(frame);
 }
+
+TEST(wire, action_template) {
+	struct ether_addr addr = {{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 }};
+	struct awdl_state state;
+	struct ieee80211_state ieee80211_state, ieee80211_state_full;
+	struct awdl_action_template tmpl;
+	uint8_t full[AWDL_ACTION_TEMPLATE_MAX_LEN];
+	int len, full_len, sync_len;
+
+	awdl_init_state(&state, "test", &addr, CHAN_OPCLASS_6, 0);
+	ieee80211_init_state(&ieee80211_state);
+	ieee80211_state_full = ieee80211_state;
+	awdl_action_template_init(&tmpl, AWDL_ACTION_MIF);
+
+	len = awdl_action_template_update(&tmpl, &state, &ieee80211_state, 1000);
+	full_len = awdl_init_full_action_frame(full, &state, &ieee80211_state_full, AWDL_ACTION_MIF, 1000);
+	EXPECT_EQ(len, full_len);
+	EXPECT_EQ(memcmp(tmpl.buf, full, len), 0); /* same time, same frame */
+
+	/* identical apart from timestamps and dynamic sync parameters */
+	sync_len = 3 + le16toh(((struct awdl_sync_params_tlv *) (tmpl.buf + tmpl.sync_params_offset))->length);
+	EXPECT_EQ(memcmp(tmpl.buf, full, tmpl.action_offset), 0);
+	EXPECT_EQ(memcmp(tmpl.buf + tmpl.sync_params_offset + sync_len, full + tmpl.sync_params_offset + sync_len,
+	                 len - tmpl.sync_params_offset - sync_len), 0);
+
+	/* unchanged state only patches the frame */
+	memcpy(full, tmpl.buf, len);
+	EXPECT_EQ(awdl_action_template_update(&tmpl, &state, &ieee80211_state, clock_time_us()), len);
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *) (tmpl.buf + tmpl.hdr_offset);
+	struct ieee80211_hdr *hdr_prev = (struct ieee80211_hdr *) (full + tmpl.hdr_offset);
+	EXPECT_EQ(le16toh(hdr->seq_ctrl), le16toh(hdr_prev->seq_ctrl) + (1 << 4));
+	EXPECT_EQ(memcmp(tmpl.buf + tmpl.sync_params_offset + sync_len, full + tmpl.sync_params_offset + sync_len,
+	                 len - tmpl.sync_params_offset - sync_len), 0);
+
+	/* changed state rebuilds the frame */
+	strcpy(state.name, "longer-name");
+	EXPECT_EQ(awdl_action_template_update(&tmpl, &state, &ieee80211_state, clock_time_us()), len + 7);
+
+	awdl_peers_free(state.peers.peers);
+}
+
+TEST(wire, encap_data) {
+	struct ether_addr src = {{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 }};
+	struct ether_addr dst = {{ 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }};
+	const uint8_t payload[] = { 0x60, 0x00, 0x00, 0x00 };
+	struct awdl_state state, state_full;
+	struct ieee80211_state ieee80211_state, ieee80211_state_full;
+	uint8_t hdr[AWDL_DATA_HDR_MAX_LEN];
+	uint8_t full[256];
+	int hdr_len, full_len;
+
+	awdl_init_state(&state, "", &src, CHAN_OPCLASS_6, 0);
+	ieee80211_init_state(&ieee80211_state);
+	ieee80211_state.fcs = true;
+	state_full = state;
+	ieee80211_state_full = ieee80211_state;
+
+	struct buf *frame = buf_new_owned_reserve(AWDL_DATA_HEADROOM, ETHER_HDR_LEN + sizeof(payload), AWDL_DATA_TAILROOM);
+	const uint8_t *payload_start = buf_data(frame) + ETHER_HDR_LEN;
+	write_ether_addr(frame, 0, &dst);
+	write_ether_addr(frame, 6, &src);
+	write_be16(frame, 12, ETH_P_IPV6);
+	write_bytes(frame, ETHER_HDR_LEN, payload, sizeof(payload));
+
+	hdr_len = awdl_init_data_hdr(hdr, &src, &dst);
+	EXPECT_LE(hdr_len, AWDL_DATA_HDR_MAX_LEN);
+	EXPECT_TRUE(awdl_data_hdr_matches(hdr, hdr_len, &src, &dst));
+	EXPECT_FALSE(awdl_data_hdr_matches(hdr, hdr_len, &dst, &src));
+
+	EXPECT_EQ(awdl_encap_data(frame, hdr, hdr_len, &state, &ieee80211_state), TX_OK);
+	full_len = awdl_init_full_data_frame(full, &src, &dst, payload, sizeof(payload), &state_full, &ieee80211_state_full);
+
+	/* payload stays in place */
+	EXPECT_EQ(buf_data(frame) + hdr_len, payload_start);
+	EXPECT_EQ(buf_len(frame), full_len);
+	EXPECT_EQ(memcmp(buf_data(frame), full, full_len), 0);
+
+	destroy_test_buf(frame);
+	awdl_peers_free(state.peers.peers);
+}